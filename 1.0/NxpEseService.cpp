@@ -19,11 +19,14 @@
 #include <android/hardware/secure_element/1.0/ISecureElement.h>
 #include <hidl/LegacySupport.h>
 #include <log/log.h>
-#include <vendor/nxp/nxpese/1.0/INxpEse.h>
+#include <vendor/nxp/nxpese/1.1/INxpEse.h>
+#include <thread>
 
+#include "NfcAdaptation.h"
 #include "NxpEse.h"
 #include "SecureElement.h"
 #include "StateMachine.h"
+#include "ese_boot_trace.h"
 #include "ese_config.h"
 
 // Generated HIDL files
@@ -34,10 +37,25 @@ using android::hardware::joinRpcThreadpool;
 using android::OK;
 using android::sp;
 using android::status_t;
-using vendor::nxp::nxpese::V1_0::INxpEse;
-using vendor::nxp::nxpese::V1_0::implementation::NxpEse;
+using vendor::nxp::nxpese::V1_1::INxpEse;
+using vendor::nxp::nxpese::V1_1::implementation::NxpEse;
+
+/*
+ * Looks up the NXP NFC HAL off the main thread. The lookup waits until the
+ * NFC HAL is registered and does not depend on anything below, so it
+ * overlaps with config parsing and service registration instead of delaying
+ * the first SecureElement::init.
+ */
+static void prefetchNfcHal() {
+  eseBootTrace_begin("nfc_hal_lookup");
+  NfcAdaptation::GetInstance().Initialize(true /*waitForService*/);
+  eseBootTrace_end("nfc_hal_lookup");
+}
 
 int main() {
+  eseBootTrace_begin("service_start");
+  std::thread(prefetchNfcHal).detach();
+
   ALOGD("Initializing State Machine...");
   StateMachine::GetInstance().ProcessExtEvent(EVT_SPI_HW_SERVICE_START);
 
@@ -47,6 +65,7 @@ int main() {
   std::string spiTermName;
   spiTermName = EseConfig::getString(NAME_NXP_SPI_TERMINAL_NAME, "eSE1");
   ALOGD("Registering SPI interface as %s", spiTermName.c_str());
+  eseBootTrace_begin("service_register");
   status_t status = se_service->registerAsService(spiTermName.c_str());
   if (status != OK) {
     LOG_ALWAYS_FATAL(
@@ -55,7 +74,7 @@ int main() {
     return -1;
   }
 
-  ALOGD("Registering SecureElement HALIOCTL Service v1.0...");
+  ALOGD("Registering SecureElement HALIOCTL Service v1.1...");
   sp<INxpEse> nxp_se_service = new NxpEse();
   status = nxp_se_service->registerAsService();
   if (status != OK) {
@@ -64,6 +83,8 @@ int main() {
         status);
     return -1;
   }
+  eseBootTrace_end("service_register");
+  eseBootTrace_end("service_start");
   ALOGD("Secure Element HAL Service is ready");
   joinRpcThreadpool();
   return 1;
@@ -16,11 +16,17 @@
  *
  ******************************************************************************/
 #define LOG_TAG "NxpEseHal"
-#define MAX_INIT_RETRY_CNT 5
+#define MAX_INIT_RETRY_CNT 8
+#define INIT_RETRY_MIN_DELAY_MS 250
+#define INIT_RETRY_MAX_DELAY_MS 2000
+#include <hwbinder/IPCThreadState.h>
 #include <log/log.h>
+#include <algorithm>
 
 #include "LsClient.h"
 #include "SecureElement.h"
+#include "ese_boot_trace.h"
+#include "ese_config.h"
 #include "phNxpEse_Api.h"
 
 extern bool ese_debug_enabled;
@@ -33,9 +39,26 @@ namespace implementation {
 
 sp<V1_0::ISecureElementHalCallback> SecureElement::mCallbackV1_0 = nullptr;
 
+/*Client of the binder call in progress, recorded as owner of the channels
+ *it opens*/
+static uint32_t getCallingClient() {
+  return (uint32_t)IPCThreadState::self()->getCallingPid();
+}
+
 SecureElement::SecureElement()
     : mOpenedchannelCount(0),
-      mOpenedChannels{false, false, false, false} {}
+      mOpenedChannels{false, false, false, false},
+      mChannelSelected{false, false, false, false},
+      mPooledChannels{false, false, false, false},
+      mPooledChannelCount(0) {
+  /*Basic channel is never pooled*/
+  mChannelPoolSize =
+      EseConfig::getUnsigned(NAME_NXP_LOGICAL_CHANNEL_POOL_SIZE, 0);
+  if (mChannelPoolSize > (MAX_LOGICAL_CHANNELS - 1))
+    mChannelPoolSize = MAX_LOGICAL_CHANNELS - 1;
+  mSelectCacheTtl = EseConfig::getUnsigned(NAME_NXP_SELECT_CACHE_TTL, 0);
+  mTransmitTimeout = EseConfig::getUnsigned(NAME_NXP_SE_TRANSMIT_TIMEOUT, 0);
+}
 
 Return<void> SecureElement::init(
     const sp<
@@ -57,24 +80,32 @@ Return<void> SecureElement::init(
   }
 
   int initRetryCount = 0;
+  /*Back off from a short delay: most failures at boot are transient*/
+  unsigned int retryDelayMs = INIT_RETRY_MIN_DELAY_MS;
 
+  eseBootTrace_begin("se_init");
   do {
     status = seHalInit();
     if (status != ESESTATUS_SUCCESS) {
       initRetryCount ++;
       if (phNxpEse_close() != ESESTATUS_SUCCESS)
         ALOGE("%s: phNxpEse_close failed!!!", __func__);
-      usleep(2* 1000 * 1000);
+      if (initRetryCount >= MAX_INIT_RETRY_CNT) break;
+      usleep(retryDelayMs * 1000);
+      retryDelayMs =
+          std::min(retryDelayMs * 2, (unsigned int)INIT_RETRY_MAX_DELAY_MS);
     }else {
       break;
     }
   } while( initRetryCount < MAX_INIT_RETRY_CNT);
+  eseBootTrace_end("se_init");
 
   if (status != ESESTATUS_SUCCESS) {
     clientCallback->onStateChange(false);
     return Void();
   }
 
+  eseBootTrace_begin("ls_download");
   LSCSTATUS lsStatus = LSC_doDownload(clientCallback);
   /*
    * LSC_doDownload returns LSCSTATUS_FAILED in case thread creation fails.
@@ -112,7 +143,8 @@ Return<void> SecureElement::transmit(const hidl_vec<uint8_t>& data,
   if (cmdApdu.len >= MIN_APDU_LENGTH) {
     cmdApdu.p_data = (uint8_t*)phNxpEse_memalloc(data.size() * sizeof(uint8_t));
     memcpy(cmdApdu.p_data, data.data(), cmdApdu.len);
-    status = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+    /*61xx/6Cxx are resolved here on channels configured for it*/
+    status = phNxpEse_TransceiveAutoResp(&cmdApdu, &rspApdu, mTransmitTimeout);
   }
 
   hidl_vec<uint8_t> result;
@@ -151,103 +183,110 @@ Return<void> SecureElement::openLogicalChannel(const hidl_vec<uint8_t>& aid,
     }
   }
 
-  SecureElementStatus sestatus = SecureElementStatus::IOERROR;
-  ESESTATUS status = ESESTATUS_FAILED;
-  phNxpEse_data cmdApdu;
-  phNxpEse_data rspApdu;
-
-  phNxpEse_memset(&cmdApdu, 0x00, sizeof(phNxpEse_data));
-  phNxpEse_memset(&rspApdu, 0x00, sizeof(phNxpEse_data));
-
-  cmdApdu.len = manageChannelCommand.size();
-  cmdApdu.p_data = (uint8_t*)phNxpEse_memalloc(manageChannelCommand.size() *
-                                               sizeof(uint8_t));
-  if (cmdApdu.p_data != NULL) {
-    memcpy(cmdApdu.p_data, manageChannelCommand.data(), cmdApdu.len);
-    status = phNxpEse_Transceive(&cmdApdu, &rspApdu);
-  }
-  if (status != ESESTATUS_SUCCESS) {
-    /*Transceive failed*/
-    sestatus = SecureElementStatus::IOERROR;
-  } else if (rspApdu.p_data[rspApdu.len - 2] == 0x90 &&
-             rspApdu.p_data[rspApdu.len - 1] == 0x00) {
-    /*ManageChannel successful*/
-    resApduBuff.channelNumber = rspApdu.p_data[0];
-    mOpenedchannelCount++;
-    mOpenedChannels[resApduBuff.channelNumber] = true;
-    sestatus = SecureElementStatus::SUCCESS;
-  } else if (rspApdu.p_data[rspApdu.len - 2] == 0x6A &&
-             rspApdu.p_data[rspApdu.len - 1] == 0x81) {
-    sestatus = SecureElementStatus::CHANNEL_NOT_AVAILABLE;
-  } else if (((rspApdu.p_data[rspApdu.len - 2] == 0x6E) ||
-              (rspApdu.p_data[rspApdu.len - 2] == 0x6D)) &&
-             rspApdu.p_data[rspApdu.len - 1] == 0x00) {
-    sestatus = SecureElementStatus::UNSUPPORTED_OPERATION;
-  }
-
-  /*Free the allocations*/
-  phNxpEse_free(cmdApdu.p_data);
-  phNxpEse_free(rspApdu.p_data);
-
-  if (sestatus != SecureElementStatus::SUCCESS) {
-    /*If first logical channel open fails, DeInit SE*/
-    if (isSeInitialized() && (mOpenedchannelCount == 0)) {
-      SecureElementStatus deInitStatus = seHalDeInit();
-      if (deInitStatus != SecureElementStatus::SUCCESS) {
+  std::vector<uint8_t> selectKey(aid.begin(), aid.end());
+  selectKey.push_back(p2);
+  SecureElementStatus cachedStatus = SecureElementStatus::FAILED;
+  if (lookupSelectCache(selectKey, cachedStatus)) {
+    /*Known to fail, spare MANAGE CHANNEL and SELECT*/
+    resApduBuff.channelNumber = 0xff;
+    if (mOpenedchannelCount == 0) {
+      if (seHalDeInit() != SecureElementStatus::SUCCESS) {
         ALOGE("%s: seDeInit Failed", __func__);
       }
     }
-    /*If manageChanle is failed in any of above cases
-    send the callback and return*/
-    _hidl_cb(resApduBuff, sestatus);
+    _hidl_cb(resApduBuff, cachedStatus);
     return Void();
   }
 
-  ALOGD_IF(ese_debug_enabled, "%s: Sending selectApdu", __func__);
-  /*Reset variables if manageChannel is success*/
-  sestatus = SecureElementStatus::IOERROR;
-  status = ESESTATUS_FAILED;
+  SecureElementStatus sestatus = SecureElementStatus::IOERROR;
+  ESESTATUS status = ESESTATUS_FAILED;
+  phNxpEse_data cmdApdu;
+  phNxpEse_data rspApdu;
 
   phNxpEse_memset(&cmdApdu, 0x00, sizeof(phNxpEse_data));
   phNxpEse_memset(&rspApdu, 0x00, sizeof(phNxpEse_data));
 
-  cmdApdu.len = (int32_t)(5 + aid.size());
-  cmdApdu.p_data = (uint8_t*)phNxpEse_memalloc(cmdApdu.len * sizeof(uint8_t));
-  if (cmdApdu.p_data != NULL) {
-    uint8_t xx = 0;
-    cmdApdu.p_data[xx++] = resApduBuff.channelNumber;
-    cmdApdu.p_data[xx++] = 0xA4;        // INS
-    cmdApdu.p_data[xx++] = 0x04;        // P1
-    cmdApdu.p_data[xx++] = p2;          // P2
-    cmdApdu.p_data[xx++] = aid.size();  // Lc
-    memcpy(&cmdApdu.p_data[xx], aid.data(), aid.size());
-
-    status = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+  uint8_t pooledChannel = 0;
+  bool pooled = false;
+  /*SELECT next occurrence depends on the current selection, only a first
+   *occurrence SELECT may reuse a pooled channel. The SELECT of the new AID
+   *resets the channel, one that does not answer it is dropped*/
+  while (((p2 & 0x03) == 0x00) && takePooledChannel(pooledChannel)) {
+    sestatus = selectOnChannel(pooledChannel, aid, p2,
+                               resApduBuff.selectResponse);
+    if (sestatus != SecureElementStatus::IOERROR) {
+      pooled = true;
+      break;
+    }
+    ALOGE("%s: pooled channel %d lost", __func__, pooledChannel);
+    if (closeChannelOnCard(pooledChannel) != SecureElementStatus::SUCCESS) {
+      ALOGD_IF(ese_debug_enabled, "%s: channel %d already closed", __func__,
+               pooledChannel);
+    }
   }
 
-  if (status != ESESTATUS_SUCCESS) {
-    /*Transceive failed*/
-    sestatus = SecureElementStatus::IOERROR;
+  if (pooled) {
+    ALOGD_IF(ese_debug_enabled, "%s: reusing pooled channel %d", __func__,
+             pooledChannel);
+    resApduBuff.channelNumber = pooledChannel;
+    mOpenedchannelCount++;
+    mOpenedChannels[pooledChannel] = true;
+    phNxpEse_SetChannelOwner(pooledChannel, getCallingClient());
   } else {
-    uint8_t sw1 = rspApdu.p_data[rspApdu.len - 2];
-    uint8_t sw2 = rspApdu.p_data[rspApdu.len - 1];
-    /*Return response on success, empty vector on failure*/
-    /*Status is success*/
-    if (sw1 == 0x90 && sw2 == 0x00) {
-      /*Copy the response including status word*/
-      resApduBuff.selectResponse.resize(rspApdu.len);
-      memcpy(&resApduBuff.selectResponse[0], rspApdu.p_data, rspApdu.len);
-      sestatus = SecureElementStatus::SUCCESS;
-    }
-    /*AID provided doesn't match any applet on the secure element*/
-    else if (sw1 == 0x6A && sw2 == 0x82) {
-      sestatus = SecureElementStatus::NO_SUCH_ELEMENT_ERROR;
+    sestatus = SecureElementStatus::IOERROR;
+    cmdApdu.len = manageChannelCommand.size();
+    cmdApdu.p_data = (uint8_t*)phNxpEse_memalloc(manageChannelCommand.size() *
+                                                 sizeof(uint8_t));
+    if (cmdApdu.p_data != NULL) {
+      memcpy(cmdApdu.p_data, manageChannelCommand.data(), cmdApdu.len);
+      status = phNxpEse_Transceive(&cmdApdu, &rspApdu);
     }
-    /*Operation provided by the P2 parameter is not permitted by the applet.*/
-    else if (sw1 == 0x6A && sw2 == 0x86) {
+    if (status != ESESTATUS_SUCCESS) {
+      /*Transceive failed*/
+      sestatus = SecureElementStatus::IOERROR;
+    } else if (rspApdu.p_data[rspApdu.len - 2] == 0x90 &&
+               rspApdu.p_data[rspApdu.len - 1] == 0x00) {
+      /*ManageChannel successful*/
+      resApduBuff.channelNumber = rspApdu.p_data[0];
+      mOpenedchannelCount++;
+      mOpenedChannels[resApduBuff.channelNumber] = true;
+      phNxpEse_SetChannelOwner(resApduBuff.channelNumber,
+                               getCallingClient());
+      sestatus = SecureElementStatus::SUCCESS;
+    } else if (rspApdu.p_data[rspApdu.len - 2] == 0x6A &&
+               rspApdu.p_data[rspApdu.len - 1] == 0x81) {
+      sestatus = SecureElementStatus::CHANNEL_NOT_AVAILABLE;
+    } else if (((rspApdu.p_data[rspApdu.len - 2] == 0x6E) ||
+                (rspApdu.p_data[rspApdu.len - 2] == 0x6D)) &&
+               rspApdu.p_data[rspApdu.len - 1] == 0x00) {
       sestatus = SecureElementStatus::UNSUPPORTED_OPERATION;
     }
+
+    /*Free the allocations*/
+    phNxpEse_free(cmdApdu.p_data);
+    phNxpEse_free(rspApdu.p_data);
+
+    if (sestatus != SecureElementStatus::SUCCESS) {
+      /*If first logical channel open fails, DeInit SE*/
+      if (isSeInitialized() && (mOpenedchannelCount == 0)) {
+        SecureElementStatus deInitStatus = seHalDeInit();
+        if (deInitStatus != SecureElementStatus::SUCCESS) {
+          ALOGE("%s: seDeInit Failed", __func__);
+        }
+      }
+      /*If manageChanle is failed in any of above cases
+      send the callback and return*/
+      _hidl_cb(resApduBuff, sestatus);
+      return Void();
+    }
+
+    ALOGD_IF(ese_debug_enabled, "%s: Sending selectApdu", __func__);
+    sestatus = selectOnChannel(resApduBuff.channelNumber, aid, p2,
+                               resApduBuff.selectResponse);
   }
+  if (sestatus == SecureElementStatus::SUCCESS)
+    mChannelSelected[resApduBuff.channelNumber] = true;
+  updateSelectCache(selectKey, sestatus);
 
   if (sestatus != SecureElementStatus::SUCCESS) {
     SecureElementStatus closeChannelStatus =
@@ -259,8 +298,6 @@ Return<void> SecureElement::openLogicalChannel(const hidl_vec<uint8_t>& aid,
     }
   }
   _hidl_cb(resApduBuff, sestatus);
-  phNxpEse_free(cmdApdu.p_data);
-  phNxpEse_free(rspApdu.p_data);
 
   return Void();
 }
@@ -279,6 +316,24 @@ Return<void> SecureElement::openBasicChannel(const hidl_vec<uint8_t>& aid,
     }
   }
 
+  std::vector<uint8_t> selectKey(aid.begin(), aid.end());
+  selectKey.push_back(p2);
+  SecureElementStatus cachedStatus = SecureElementStatus::FAILED;
+  if (lookupBasicSelect(selectKey, result)) {
+    /*AID is still selected and untouched on the basic channel*/
+    _hidl_cb(result, SecureElementStatus::SUCCESS);
+    return Void();
+  }
+  if (lookupSelectCache(selectKey, cachedStatus)) {
+    /*Same handling as a failed SELECT sent to the eSE*/
+    if (mOpenedChannels[0] &&
+        (closeChannel(DEFAULT_BASIC_CHANNEL) != SecureElementStatus::SUCCESS)) {
+      ALOGE("%s: closeChannel Failed", __func__);
+    }
+    _hidl_cb(result, cachedStatus);
+    return Void();
+  }
+
   SecureElementStatus sestatus = SecureElementStatus::IOERROR;
   ESESTATUS status = ESESTATUS_FAILED;
   phNxpEse_data cmdApdu;
@@ -317,7 +372,9 @@ Return<void> SecureElement::openBasicChannel(const hidl_vec<uint8_t>& aid,
       if (!mOpenedChannels[0]) {
         mOpenedChannels[0] = true;
         mOpenedchannelCount++;
+        phNxpEse_SetChannelOwner(DEFAULT_BASIC_CHANNEL, getCallingClient());
       }
+      updateBasicSelect(selectKey, result);
       sestatus = SecureElementStatus::SUCCESS;
     }
     /*AID provided doesn't match any applet on the secure element*/
@@ -330,6 +387,7 @@ Return<void> SecureElement::openBasicChannel(const hidl_vec<uint8_t>& aid,
     }
   }
 
+  updateSelectCache(selectKey, sestatus);
   if ((sestatus != SecureElementStatus::SUCCESS) && mOpenedChannels[0]) {
     SecureElementStatus closeChannelStatus =
         closeChannel(DEFAULT_BASIC_CHANNEL);
@@ -345,43 +403,25 @@ Return<void> SecureElement::openBasicChannel(const hidl_vec<uint8_t>& aid,
 
 Return<::android::hardware::secure_element::V1_0::SecureElementStatus>
 SecureElement::closeChannel(uint8_t channelNumber) {
-  ESESTATUS status = ESESTATUS_FAILED;
   SecureElementStatus sestatus = SecureElementStatus::FAILED;
 
-  phNxpEse_data cmdApdu;
-  phNxpEse_data rspApdu;
-
   if ((channelNumber < DEFAULT_BASIC_CHANNEL) ||
       (channelNumber >= MAX_LOGICAL_CHANNELS) ||
       (mOpenedChannels[channelNumber] == false)) {
     ALOGE("%s: invalid channel!!!", __func__);
     sestatus = SecureElementStatus::FAILED;
+  } else if ((channelNumber > DEFAULT_BASIC_CHANNEL) &&
+             mChannelSelected[channelNumber] &&
+             (mPooledChannelCount < mChannelPoolSize)) {
+    /*Keep the channel open on the card, the next SELECT replaces the
+     *applet selected on it*/
+    ALOGD_IF(ese_debug_enabled, "%s: channel %d back to pool", __func__,
+             channelNumber);
+    mPooledChannels[channelNumber] = true;
+    mPooledChannelCount++;
+    sestatus = SecureElementStatus::SUCCESS;
   } else if (channelNumber > DEFAULT_BASIC_CHANNEL) {
-    phNxpEse_memset(&cmdApdu, 0x00, sizeof(phNxpEse_data));
-    phNxpEse_memset(&rspApdu, 0x00, sizeof(phNxpEse_data));
-    cmdApdu.p_data = (uint8_t*)phNxpEse_memalloc(5 * sizeof(uint8_t));
-    if (cmdApdu.p_data != NULL) {
-      uint8_t xx = 0;
-
-      cmdApdu.p_data[xx++] = channelNumber;
-      cmdApdu.p_data[xx++] = 0x70;           // INS
-      cmdApdu.p_data[xx++] = 0x80;           // P1
-      cmdApdu.p_data[xx++] = channelNumber;  // P2
-      cmdApdu.p_data[xx++] = 0x00;           // Lc
-      cmdApdu.len = xx;
-
-      status = phNxpEse_Transceive(&cmdApdu, &rspApdu);
-    }
-    if (status != ESESTATUS_SUCCESS) {
-      sestatus = SecureElementStatus::FAILED;
-    } else if ((rspApdu.p_data[rspApdu.len - 2] == 0x90) &&
-               (rspApdu.p_data[rspApdu.len - 1] == 0x00)) {
-      sestatus = SecureElementStatus::SUCCESS;
-    } else {
-      sestatus = SecureElementStatus::FAILED;
-    }
-    phNxpEse_free(cmdApdu.p_data);
-    phNxpEse_free(rspApdu.p_data);
+    sestatus = closeChannelOnCard(channelNumber);
   }
 
   if ((channelNumber == DEFAULT_BASIC_CHANNEL) ||
@@ -389,6 +429,11 @@ SecureElement::closeChannel(uint8_t channelNumber) {
     if(mOpenedChannels[channelNumber] != false)
       mOpenedchannelCount--;
     mOpenedChannels[channelNumber] = false;
+    mChannelSelected[channelNumber] = false;
+    phNxpEse_SetChannelOwner(channelNumber, 0);
+    if (channelNumber == DEFAULT_BASIC_CHANNEL) mBasicSelectValid = false;
+    /*Runtime opt-in belongs to the client of the closed channel*/
+    phNxpEse_SetAutoGetResponse(channelNumber, false);
     /*If there are no channels remaining close secureElement*/
     if (mOpenedchannelCount == 0) {
       sestatus = seHalDeInit();
@@ -410,7 +455,200 @@ void SecureElement::serviceDied(uint64_t /*cookie*/, const wp<IBase>& /*who*/) {
   }
 }
 
-bool SecureElement::isSeInitialized() { return phNxpEse_isOpen(); }
+SecureElementStatus SecureElement::closeChannelOnCard(uint8_t channelNumber) {
+  ESESTATUS status = ESESTATUS_FAILED;
+  SecureElementStatus sestatus = SecureElementStatus::FAILED;
+  phNxpEse_data cmdApdu;
+  phNxpEse_data rspApdu;
+
+  phNxpEse_memset(&cmdApdu, 0x00, sizeof(phNxpEse_data));
+  phNxpEse_memset(&rspApdu, 0x00, sizeof(phNxpEse_data));
+  cmdApdu.p_data = (uint8_t*)phNxpEse_memalloc(5 * sizeof(uint8_t));
+  if (cmdApdu.p_data != NULL) {
+    uint8_t xx = 0;
+
+    cmdApdu.p_data[xx++] = channelNumber;
+    cmdApdu.p_data[xx++] = 0x70;           // INS
+    cmdApdu.p_data[xx++] = 0x80;           // P1
+    cmdApdu.p_data[xx++] = channelNumber;  // P2
+    cmdApdu.p_data[xx++] = 0x00;           // Lc
+    cmdApdu.len = xx;
+
+    status = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+  }
+  if (status != ESESTATUS_SUCCESS) {
+    sestatus = SecureElementStatus::FAILED;
+  } else if ((rspApdu.p_data[rspApdu.len - 2] == 0x90) &&
+             (rspApdu.p_data[rspApdu.len - 1] == 0x00)) {
+    sestatus = SecureElementStatus::SUCCESS;
+  } else {
+    sestatus = SecureElementStatus::FAILED;
+  }
+  phNxpEse_free(cmdApdu.p_data);
+  phNxpEse_free(rspApdu.p_data);
+  return sestatus;
+}
+
+SecureElementStatus SecureElement::selectOnChannel(
+    uint8_t channelNumber, const hidl_vec<uint8_t>& aid, uint8_t p2,
+    hidl_vec<uint8_t>& selectResponse) {
+  ESESTATUS status = ESESTATUS_FAILED;
+  SecureElementStatus sestatus = SecureElementStatus::IOERROR;
+  phNxpEse_data cmdApdu;
+  phNxpEse_data rspApdu;
+
+  phNxpEse_memset(&cmdApdu, 0x00, sizeof(phNxpEse_data));
+  phNxpEse_memset(&rspApdu, 0x00, sizeof(phNxpEse_data));
+
+  cmdApdu.len = (int32_t)(5 + aid.size());
+  cmdApdu.p_data = (uint8_t*)phNxpEse_memalloc(cmdApdu.len * sizeof(uint8_t));
+  if (cmdApdu.p_data != NULL) {
+    uint8_t xx = 0;
+    cmdApdu.p_data[xx++] = channelNumber;
+    cmdApdu.p_data[xx++] = 0xA4;        // INS
+    cmdApdu.p_data[xx++] = 0x04;        // P1
+    cmdApdu.p_data[xx++] = p2;          // P2
+    cmdApdu.p_data[xx++] = aid.size();  // Lc
+    memcpy(&cmdApdu.p_data[xx], aid.data(), aid.size());
+
+    status = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+  }
+
+  if (status != ESESTATUS_SUCCESS) {
+    /*Transceive failed*/
+    sestatus = SecureElementStatus::IOERROR;
+  } else {
+    uint8_t sw1 = rspApdu.p_data[rspApdu.len - 2];
+    uint8_t sw2 = rspApdu.p_data[rspApdu.len - 1];
+    /*Return response on success, empty vector on failure*/
+    /*Status is success*/
+    if (sw1 == 0x90 && sw2 == 0x00) {
+      /*Copy the response including status word*/
+      selectResponse.resize(rspApdu.len);
+      memcpy(&selectResponse[0], rspApdu.p_data, rspApdu.len);
+      sestatus = SecureElementStatus::SUCCESS;
+    }
+    /*AID provided doesn't match any applet on the secure element*/
+    else if (sw1 == 0x6A && sw2 == 0x82) {
+      sestatus = SecureElementStatus::NO_SUCH_ELEMENT_ERROR;
+    }
+    /*Operation provided by the P2 parameter is not permitted by the applet.*/
+    else if (sw1 == 0x6A && sw2 == 0x86) {
+      sestatus = SecureElementStatus::UNSUPPORTED_OPERATION;
+    }
+  }
+  phNxpEse_free(cmdApdu.p_data);
+  phNxpEse_free(rspApdu.p_data);
+  return sestatus;
+}
+
+bool SecureElement::takePooledChannel(uint8_t& channelNumber) {
+  for (uint8_t xx = 1; xx < MAX_LOGICAL_CHANNELS; xx++) {
+    if (mPooledChannels[xx]) {
+      mPooledChannels[xx] = false;
+      mPooledChannelCount--;
+      channelNumber = xx;
+      return true;
+    }
+  }
+  return false;
+}
+
+void SecureElement::drainChannelPool() {
+  for (uint8_t xx = 1; xx < MAX_LOGICAL_CHANNELS; xx++) {
+    if (!mPooledChannels[xx]) continue;
+    mPooledChannels[xx] = false;
+    if (isSeInitialized() &&
+        (closeChannelOnCard(xx) != SecureElementStatus::SUCCESS)) {
+      ALOGE("%s: closing pooled channel %d failed", __func__, xx);
+    }
+  }
+  mPooledChannelCount = 0;
+}
+
+bool SecureElement::lookupSelectCache(const std::vector<uint8_t>& key,
+                                      SecureElementStatus& status) {
+  if (mSelectCacheTtl == 0) return false;
+  if (mSelectCacheGeneration != phNxpEse_GetContentGeneration()) {
+    /*Applets changed since the cache was filled*/
+    clearSelectCache();
+  }
+  auto entry = mSelectCache.find(key);
+  if ((entry == mSelectCache.end()) ||
+      (std::chrono::steady_clock::now() - entry->second.time >
+       std::chrono::milliseconds(mSelectCacheTtl))) {
+    mSelectCacheMisses++;
+    return false;
+  }
+  mSelectCacheHits++;
+  status = entry->second.status;
+  ALOGD_IF(ese_debug_enabled, "%s: SELECT answered from cache", __func__);
+  return true;
+}
+
+void SecureElement::updateSelectCache(const std::vector<uint8_t>& key,
+                                      SecureElementStatus status) {
+  if (mSelectCacheTtl == 0) return;
+  if ((status != SecureElementStatus::NO_SUCH_ELEMENT_ERROR) &&
+      (status != SecureElementStatus::UNSUPPORTED_OPERATION)) {
+    /*Only definite applet answers are cached, not I/O errors*/
+    mSelectCache.erase(key);
+    return;
+  }
+  if (mSelectCache.empty()) {
+    mSelectCacheGeneration = phNxpEse_GetContentGeneration();
+  } else if (mSelectCache.size() >= SELECT_CACHE_MAX_ENTRIES) {
+    mSelectCache.clear();
+  }
+  mSelectCache[key] = {status, std::chrono::steady_clock::now()};
+}
+
+void SecureElement::clearSelectCache() {
+  mSelectCache.clear();
+  mSelectCacheGeneration = phNxpEse_GetContentGeneration();
+  mBasicSelectValid = false;
+}
+
+/*Total APDUs exchanged with the eSE by any client*/
+static uint32_t getEseApduCount() {
+  phNxpEse_ArbStats_t stats;
+  phNxpEse_GetArbStats(&stats);
+  return stats.fgApduCount + stats.bgApduCount + stats.leaseApduCount;
+}
+
+bool SecureElement::lookupBasicSelect(const std::vector<uint8_t>& key,
+                                      hidl_vec<uint8_t>& response) {
+  /*Only a first occurrence SELECT gives the same result when repeated*/
+  if ((mSelectCacheTtl == 0) || !mBasicSelectValid || !mOpenedChannels[0] ||
+      ((key.back() & 0x03) != 0x00) || (key != mBasicSelectKey))
+    return false;
+  if ((mSelectCacheGeneration != phNxpEse_GetContentGeneration()) ||
+      (getEseApduCount() != mBasicSelectApduCount)) {
+    mBasicSelectValid = false;
+    mSelectCacheMisses++;
+    return false;
+  }
+  mSelectCacheHits++;
+  response = mBasicSelectResponse;
+  ALOGD_IF(ese_debug_enabled, "%s: basic channel re-SELECT skipped", __func__);
+  return true;
+}
+
+void SecureElement::updateBasicSelect(const std::vector<uint8_t>& key,
+                                      const hidl_vec<uint8_t>& response) {
+  if (mSelectCacheTtl == 0) return;
+  if (mSelectCacheGeneration != phNxpEse_GetContentGeneration())
+    clearSelectCache();
+  mBasicSelectKey = key;
+  mBasicSelectResponse = response;
+  mBasicSelectApduCount = getEseApduCount();
+  mBasicSelectValid = true;
+}
+
+bool SecureElement::isSeInitialized() {
+  /*A session opened for deferred requests is taken over by seHalInit*/
+  return phNxpEse_isOpen() && !phNxpEse_isDeferredWindow();
+}
 
 ESESTATUS SecureElement::seHalInit() {
   ESESTATUS status = ESESTATUS_SUCCESS;
@@ -418,6 +656,11 @@ ESESTATUS SecureElement::seHalInit() {
   memset(&initParams, 0x00, sizeof(phNxpEse_initParams));
   initParams.initMode = ESE_MODE_NORMAL;
 
+  /*Share the power window of deferred requests instead of a new one*/
+  if (phNxpEse_AdoptPowerWindow()) return ESESTATUS_SUCCESS;
+  /*Channels pooled in a handed over session were closed with it*/
+  drainChannelPool();
+
   status = phNxpEse_open(initParams);
   if (status != ESESTATUS_SUCCESS) {
     ALOGE("%s: SecureElement open failed!!!", __func__);
@@ -434,6 +677,22 @@ Return<::android::hardware::secure_element::V1_0::SecureElementStatus>
 SecureElement::seHalDeInit() {
   ESESTATUS status = ESESTATUS_SUCCESS;
   SecureElementStatus sestatus = SecureElementStatus::FAILED;
+  clearSelectCache();
+  ALOGD_IF(ese_debug_enabled, "%s: select cache hits %u misses %u", __func__,
+           mSelectCacheHits, mSelectCacheMisses);
+  /*Deferred requests still running keep the eSE powered, the scheduler
+   * closes the session after the last one. Pooled channels stay open on
+   * the card meanwhile, the SELECT reusing one checks it is still open*/
+  if ((mOpenedchannelCount == 0) && phNxpEse_HandOverPowerWindow()) {
+    for (uint8_t xx = 0; xx < MAX_LOGICAL_CHANNELS; xx++) {
+      mOpenedChannels[xx] = false;
+      mChannelSelected[xx] = false;
+      phNxpEse_SetChannelOwner(xx, 0);
+    }
+    return SecureElementStatus::SUCCESS;
+  }
+  /*Pooled channels do not outlive the session*/
+  drainChannelPool();
   status = phNxpEse_deInit();
   if (status != ESESTATUS_SUCCESS) {
     sestatus = SecureElementStatus::FAILED;
@@ -446,6 +705,8 @@ SecureElement::seHalDeInit() {
 
       for (uint8_t xx = 0; xx < MAX_LOGICAL_CHANNELS; xx++) {
         mOpenedChannels[xx] = false;
+        mChannelSelected[xx] = false;
+        phNxpEse_SetChannelOwner(xx, 0);
       }
       mOpenedchannelCount = 0;
     }
@@ -21,6 +21,9 @@
 #include <android/hardware/secure_element/1.0/ISecureElement.h>
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
+#include <chrono>
+#include <map>
+#include <vector>
 #include "phNxpEse_Api.h"
 
 namespace android {
@@ -45,6 +48,9 @@ using ::android::sp;
 #ifndef DEFAULT_BASIC_CHANNEL
 #define DEFAULT_BASIC_CHANNEL 0x00
 #endif
+#ifndef SELECT_CACHE_MAX_ENTRIES
+#define SELECT_CACHE_MAX_ENTRIES 32
+#endif
 
 struct SecureElement : public ISecureElement, public hidl_death_recipient {
   SecureElement();
@@ -65,11 +71,49 @@ struct SecureElement : public ISecureElement, public hidl_death_recipient {
  private:
   uint8_t mOpenedchannelCount = 0;
   bool mOpenedChannels[MAX_LOGICAL_CHANNELS];
+  /*Channels whose SELECT succeeded, only those may be pooled*/
+  bool mChannelSelected[MAX_LOGICAL_CHANNELS];
+  /*Channels open on the card but not owned by any client*/
+  bool mPooledChannels[MAX_LOGICAL_CHANNELS];
+  uint8_t mPooledChannelCount = 0;
+  uint8_t mChannelPoolSize = 0;
+  /*Failed SELECT outcomes keyed by AID + P2*/
+  struct SelectCacheEntry {
+    SecureElementStatus status;
+    std::chrono::steady_clock::time_point time;
+  };
+  std::map<std::vector<uint8_t>, SelectCacheEntry> mSelectCache;
+  uint32_t mSelectCacheGeneration = 0;
+  uint32_t mSelectCacheTtl = 0;
+  uint32_t mSelectCacheHits = 0;
+  uint32_t mSelectCacheMisses = 0;
+  /*Time budget of transmit in ms, 0 for none*/
+  uint32_t mTransmitTimeout = 0;
+  /*Last basic channel SELECT, reusable while no other APDU was exchanged*/
+  bool mBasicSelectValid = false;
+  uint32_t mBasicSelectApduCount = 0;
+  std::vector<uint8_t> mBasicSelectKey;
+  hidl_vec<uint8_t> mBasicSelectResponse;
   static sp<V1_0::ISecureElementHalCallback> mCallbackV1_0;
   Return<::android::hardware::secure_element::V1_0::SecureElementStatus>
   seHalDeInit();
   ESESTATUS seHalInit();
   bool isSeInitialized();
+  SecureElementStatus closeChannelOnCard(uint8_t channelNumber);
+  SecureElementStatus selectOnChannel(uint8_t channelNumber,
+                                      const hidl_vec<uint8_t>& aid, uint8_t p2,
+                                      hidl_vec<uint8_t>& selectResponse);
+  bool takePooledChannel(uint8_t& channelNumber);
+  void drainChannelPool();
+  bool lookupSelectCache(const std::vector<uint8_t>& key,
+                         SecureElementStatus& status);
+  void updateSelectCache(const std::vector<uint8_t>& key,
+                         SecureElementStatus status);
+  void clearSelectCache();
+  bool lookupBasicSelect(const std::vector<uint8_t>& key,
+                         hidl_vec<uint8_t>& response);
+  void updateBasicSelect(const std::vector<uint8_t>& key,
+                         const hidl_vec<uint8_t>& response);
 };
 
 }  // namespace implementation
@@ -16,17 +16,142 @@
  *
  ******************************************************************************/
 
-#define LOG_TAG "vendor.nxp.nxpese@1.0-impl"
+#define LOG_TAG "vendor.nxp.nxpese@1.1-impl"
 #include "NxpEse.h"
+#include "LsClient.h"
 #include "phNxpEse_Api.h"
+#include <hidl/HidlTransportSupport.h>
+#include <hwbinder/IPCThreadState.h>
 #include <log/log.h>
+#include <vector>
 
 namespace vendor {
 namespace nxp {
 namespace nxpese {
-namespace V1_0 {
+namespace V1_1 {
 namespace implementation {
 using ::android::hardware::hidl_vec;
+using ::android::hardware::interfacesEqual;
+using ::android::hardware::IPCThreadState;
+using ::vendor::nxp::nxpese::V1_1::SpiAvailability;
+
+#define BASIC_CHANNEL 0x00
+#define BATCH_MIN_APDU_LENGTH 0x04
+#define SCRIPT_INSTR_HEADER_LEN 0x03
+#define SCRIPT_COPY_HEADER_LEN 0x06
+#define SCRIPT_JUMP_PAYLOAD_LEN 0x06
+#define SCRIPT_MAX_INSTRUCTIONS 64
+#define SCRIPT_MAX_STEPS 256
+#define SCRIPT_INS_MANAGE_CHANNEL 0x70
+#define SCRIPT_INS_GET_RESPONSE 0xC0
+/*Largest responses of a short and an extended APDU, with status word*/
+#define RSP_MAX_SHORT_LEN 0x0102
+#define RSP_MAX_EXTENDED_LEN 0x10002
+#define DATA_QUEUE_MIN_SIZE RSP_MAX_SHORT_LEN
+#define DATA_QUEUE_MAX_SIZE 0x10100
+#define DATA_PATH_MAX_CLIENTS 4
+/*Death notification cookies, lease ids never reach this range*/
+#define DEATH_COOKIE_DATA_PATH (1ULL << 63)
+#define DEATH_COOKIE_CALLBACK (DEATH_COOKIE_DATA_PATH + 1)
+
+/*Logical channel number addressed by the CLA byte of an APDU*/
+static uint8_t getApduChannel(uint8_t cla) {
+  if ((cla & 0x40) == 0x40) return 0x04 + (cla & 0x0F);
+  return (cla & 0x03);
+}
+
+/*Client of the binder call in progress, as recorded by SecureElement for
+ *the channels it opened*/
+static uint32_t getCallingClient() {
+  return (uint32_t)IPCThreadState::self()->getCallingPid();
+}
+
+/*Clients notified of SPI availability changes*/
+static std::mutex sCallbackLock;
+static std::vector<sp<INxpEseCallback>> sCallbacks;
+
+/*******************************************************************************
+**
+** Function:        notifySpiAvailability
+**
+** Description:     SPI availability callback of the library, forwards the
+**                  change to the registered clients. Clients that cannot be
+**                  reached anymore are dropped.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void notifySpiAvailability(phNxpEse_SpiAvailability_t state,
+                                  uint8_t felicaSessions) {
+  std::lock_guard<std::mutex> lock(sCallbackLock);
+  for (auto it = sCallbacks.begin(); it != sCallbacks.end();) {
+    /*oneway, only queues the transaction*/
+    if ((*it)
+            ->onSpiAvailabilityChanged((SpiAvailability)state, felicaSessions)
+            .isOk()) {
+      ++it;
+    } else {
+      ALOGE("notifySpiAvailability(): dropping unreachable client");
+      it = sCallbacks.erase(it);
+    }
+  }
+}
+
+/*Status word of a response, 0 if the response is too short*/
+static uint16_t getStatusWord(const hidl_vec<uint8_t>& rsp) {
+  size_t len = rsp.size();
+  if (len < 2) return 0;
+  return (uint16_t)((rsp[len - 2] << 8) | rsp[len - 1]);
+}
+
+/*******************************************************************************
+**
+** Function:        transceiveApdu
+**
+** Description:     Exchanges one APDU with the eSE on behalf of owner, under
+**                  leaseId if not 0, with background priority if background
+**                  is set. If owner is not 0 the library refuses APDUs on
+**                  channels owner does not hold.
+**                  On a write failure (eSE in use by NFC) rsp carries the
+**                  0x65 indication used by SecureElement::transmit,
+**                  otherwise the eSE response.
+**
+** Returns:         ESESTATUS_SUCCESS if the eSE response is in rsp
+**
+*******************************************************************************/
+static ESESTATUS transceiveApdu(const uint8_t* cmd, size_t len,
+                                hidl_vec<uint8_t>& rsp, uint32_t owner,
+                                uint64_t leaseId = 0,
+                                bool background = false) {
+  phNxpEse_data cmdApdu;
+  phNxpEse_data rspApdu;
+  phNxpEse_memset(&cmdApdu, 0x00, sizeof(phNxpEse_data));
+  phNxpEse_memset(&rspApdu, 0x00, sizeof(phNxpEse_data));
+
+  ESESTATUS status = ESESTATUS_FAILED;
+  cmdApdu.len = len;
+  cmdApdu.p_data = (uint8_t*)phNxpEse_memalloc(len * sizeof(uint8_t));
+  if (cmdApdu.p_data != NULL) {
+    memcpy(cmdApdu.p_data, cmd, len);
+    if (leaseId != 0)
+      status = phNxpEse_LeaseTransceive(leaseId, owner, &cmdApdu, &rspApdu);
+    else if (background)
+      status = phNxpEse_BgClientTransceive(owner, &cmdApdu, &rspApdu);
+    else
+      status = phNxpEse_ClientTransceive(owner, &cmdApdu, &rspApdu);
+  }
+  if (status == ESESTATUS_WRITE_FAILED) {
+    rsp.resize(2);
+    rsp[0] = 0x65;
+    rsp[1] = ESESTATUS_WRITE_FAILED;
+  } else if (status == ESESTATUS_SUCCESS) {
+    rsp.resize(rspApdu.len);
+    if (rspApdu.len > 0) memcpy(&rsp[0], rspApdu.p_data, rspApdu.len);
+  }
+  phNxpEse_free(cmdApdu.p_data);
+  phNxpEse_free(rspApdu.p_data);
+  return status;
+}
 // Methods from ::vendor::nxp::nxpese::V1_0::INxpEse follow.
 Return<void> NxpEse::ioctl(uint64_t ioctlType,
                            const hidl_vec<uint8_t>& inOutData,
@@ -42,7 +167,44 @@ Return<void> NxpEse::ioctl(uint64_t ioctlType,
   inpOutData.inp.data.nxpCmd.cmd_len = inOutData.size();
   memcpy(&inpOutData.inp.data.nxpCmd.p_cmd, pInOutData,
          inpOutData.inp.data.nxpCmd.cmd_len);
-  ESESTATUS status = phNxpEse_spiIoctl(ioctlType, &inpOutData);
+  ESESTATUS status = ESESTATUS_FAILED;
+  if (ioctlType == HAL_ESE_IOCTL_GET_LS_PROGRESS) {
+    /*LS runs in this process, answer without involving the SPI library*/
+    if (LSC_GetProgress(&inpOutData.out.data.lsProgress) == LSCSTATUS_SUCCESS)
+      status = ESESTATUS_SUCCESS;
+  } else if (ioctlType == HAL_ESE_IOCTL_GET_PRIO_STATS) {
+    phNxpEse_ArbStats_t stats;
+    phNxpEse_GetArbStats(&stats);
+    ese_nxp_PrioStats_t& prio = inpOutData.out.data.prioStats;
+    prio.grantCount = stats.prioCount;
+    prio.timeoutCount = stats.prioTimeoutCount;
+    prio.preemptCount = stats.prioPreemptCount;
+    prio.avgWaitMs =
+        (stats.prioCount != 0) ? (stats.prioWaitTimeMs / stats.prioCount) : 0;
+    prio.maxWaitMs = stats.prioWaitMaxMs;
+    status = ESESTATUS_SUCCESS;
+  } else if (ioctlType == HAL_ESE_IOCTL_GET_RF_BLOCK_STATS) {
+    phNxpEse_ArbStats_t stats;
+    phNxpEse_SpiAvailability_t state;
+    phNxpEse_GetArbStats(&stats);
+    ese_nxp_RfBlockStats_t& rf = inpOutData.out.data.rfBlockStats;
+    rf.blockCount = stats.rfBlockCount;
+    rf.failCount = stats.rfBlockFailCount;
+    rf.avgBlockMs = (stats.rfBlockCount != 0)
+                        ? (stats.rfBlockTimeMs / stats.rfBlockCount)
+                        : 0;
+    rf.maxBlockMs = stats.rfBlockMaxMs;
+    rf.totalBlockMs = stats.rfBlockTimeMs;
+    rf.ntfCount = phNxpEse_GetSpiAvailability(&state, &rf.felicaSessions);
+    rf.state = state;
+    status = ESESTATUS_SUCCESS;
+  } else if (ioctlType == HAL_ESE_IOCTL_SET_AUTO_GET_RESPONSE) {
+    /*p_cmd[0]: logical channel, p_cmd[1]: 1 to enable, 0 to disable*/
+    status = phNxpEse_SetAutoGetResponse(inpOutData.inp.data.nxpCmd.p_cmd[0],
+                                         inpOutData.inp.data.nxpCmd.p_cmd[1]);
+  } else {
+    status = phNxpEse_spiIoctl(ioctlType, &inpOutData);
+  }
 
   /*copy data and additional fields indicating status of ioctl operation
    * and context of the caller. Then invoke the corresponding proxy callback*/
@@ -70,10 +232,669 @@ Return<void> NxpEse::nfccNtf(uint64_t ntfType,
   return Void();
 }
 
+// Methods from ::vendor::nxp::nxpese::V1_1::INxpEse follow.
+Return<void> NxpEse::transmitBatch(const hidl_vec<hidl_vec<uint8_t>>& apdus,
+                                   bool stopOnError,
+                                   transmitBatch_cb _hidl_cb) {
+  ALOGD("NxpEse::transmitBatch(): enter count=%zu", apdus.size());
+  hidl_vec<hidl_vec<uint8_t>> responses;
+
+  if (apdus.size() == 0 || !phNxpEse_isOpen()) {
+    ALOGE("NxpEse::transmitBatch(): eSE not open or empty batch");
+    _hidl_cb(responses);
+    return Void();
+  }
+  /*Channels are opened through SecureElement only. The library checks
+   *with each APDU that the caller holds its channel, or that the basic
+   *channel is not held by anyone*/
+  for (size_t i = 0; i < apdus.size(); i++) {
+    if ((apdus[i].size() < BATCH_MIN_APDU_LENGTH) ||
+        (apdus[i][1] == SCRIPT_INS_MANAGE_CHANNEL)) {
+      ALOGE("NxpEse::transmitBatch(): invalid APDU at index %zu", i);
+      _hidl_cb(responses);
+      return Void();
+    }
+  }
+
+  uint32_t client = getCallingClient();
+  responses.resize(apdus.size());
+  size_t executed = 0;
+  while (executed < apdus.size()) {
+    hidl_vec<uint8_t>& result = responses[executed];
+    ESESTATUS status = transceiveApdu(apdus[executed].data(),
+                                      apdus[executed].size(), result, client);
+    if (status == ESESTATUS_NOT_ALLOWED) {
+      ALOGE("NxpEse::transmitBatch(): channel not held at index %zu",
+            executed);
+      break;
+    }
+    executed++;
+    if (status != ESESTATUS_SUCCESS) {
+      ALOGE("NxpEse::transmitBatch(): transmit failed at index %zu",
+            executed - 1);
+      break;
+    }
+    if (stopOnError && (getStatusWord(result) != 0x9000)) break;
+  }
+  /*Only the executed APDUs have a response*/
+  responses.resize(executed);
+  _hidl_cb(responses);
+  ALOGD("NxpEse::transmitBatch(): exit executed=%zu", executed);
+  return Void();
+}
+
+/*One decoded instruction of a runScript script*/
+typedef struct {
+  ScriptOp op;
+  const uint8_t* payload;
+  uint16_t len;
+} scriptInstr_t;
+
+static uint16_t getScriptU16(const uint8_t* p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/*******************************************************************************
+**
+** Function:        checkScriptApdu
+**
+** Description:     Sandbox rules for an APDU of a script: valid header and no
+**                  MANAGE CHANNEL. The channel is checked by the library
+**                  when the APDU is exchanged.
+**
+** Returns:         true if the APDU may be sent
+**
+*******************************************************************************/
+static bool checkScriptApdu(const uint8_t* apdu, uint16_t len) {
+  if (len < BATCH_MIN_APDU_LENGTH) return false;
+  return (apdu[1] != SCRIPT_INS_MANAGE_CHANNEL);
+}
+
+/*******************************************************************************
+**
+** Function:        decodeScript
+**
+** Description:     Splits a runScript script into instructions and validates
+**                  all of them before anything is sent to the eSE.
+**
+** Returns:         true if the script is well formed
+**
+*******************************************************************************/
+static bool decodeScript(const hidl_vec<uint8_t>& script,
+                         std::vector<scriptInstr_t>& instrs) {
+  size_t off = 0;
+  while (off < script.size()) {
+    if ((script.size() - off) < SCRIPT_INSTR_HEADER_LEN) return false;
+    if (instrs.size() >= SCRIPT_MAX_INSTRUCTIONS) return false;
+    scriptInstr_t instr;
+    instr.op = (ScriptOp)script[off];
+    instr.len = getScriptU16(&script[off + 1]);
+    off += SCRIPT_INSTR_HEADER_LEN;
+    if ((script.size() - off) < instr.len) return false;
+    instr.payload = &script[0] + off;
+    off += instr.len;
+
+    switch (instr.op) {
+      case ScriptOp::SEND:
+        if (!checkScriptApdu(instr.payload, instr.len)) return false;
+        break;
+      case ScriptOp::SEND_COPY:
+        if (instr.len < SCRIPT_COPY_HEADER_LEN) return false;
+        if (!checkScriptApdu(instr.payload + SCRIPT_COPY_HEADER_LEN,
+                             instr.len - SCRIPT_COPY_HEADER_LEN))
+          return false;
+        /*Copy must stay inside the APDU body, the header is immutable*/
+        if ((getScriptU16(instr.payload + 4) < BATCH_MIN_APDU_LENGTH) ||
+            ((uint32_t)getScriptU16(instr.payload + 4) +
+                 getScriptU16(instr.payload + 2) >
+             (uint32_t)(instr.len - SCRIPT_COPY_HEADER_LEN)))
+          return false;
+        break;
+      case ScriptOp::JUMP_IF_SW:
+        if (instr.len != SCRIPT_JUMP_PAYLOAD_LEN) return false;
+        break;
+      case ScriptOp::GET_RESPONSE:
+      case ScriptOp::EXIT:
+      case ScriptOp::ABORT:
+        if (instr.len != 0) return false;
+        break;
+      default:
+        return false;
+    }
+    instrs.push_back(instr);
+  }
+  /*Jump targets are checked once the instruction count is known*/
+  for (const scriptInstr_t& instr : instrs) {
+    if ((instr.op == ScriptOp::JUMP_IF_SW) &&
+        (getScriptU16(instr.payload + 4) > instrs.size()))
+      return false;
+  }
+  return (instrs.size() > 0);
+}
+
+Return<void> NxpEse::runScript(const hidl_vec<uint8_t>& script,
+                               runScript_cb _hidl_cb) {
+  ALOGD("NxpEse::runScript(): enter len=%zu", script.size());
+  std::vector<hidl_vec<uint8_t>> responses;
+  std::vector<scriptInstr_t> instrs;
+
+  if (!decodeScript(script, instrs)) {
+    ALOGE("NxpEse::runScript(): invalid script");
+    _hidl_cb(ScriptStatus::INVALID_SCRIPT, hidl_vec<hidl_vec<uint8_t>>());
+    return Void();
+  }
+  if (!phNxpEse_isOpen()) {
+    ALOGE("NxpEse::runScript(): eSE not open");
+    _hidl_cb(ScriptStatus::TRANSMIT_FAILED, hidl_vec<hidl_vec<uint8_t>>());
+    return Void();
+  }
+
+  ScriptStatus result = ScriptStatus::SUCCESS;
+  uint32_t client = getCallingClient();
+  std::vector<uint8_t> apdu;
+  uint8_t lastCla = 0x00;
+  size_t pc = 0;
+  uint32_t steps = 0;
+  while (pc < instrs.size()) {
+    if (++steps > SCRIPT_MAX_STEPS) {
+      result = ScriptStatus::STEP_LIMIT;
+      break;
+    }
+    const scriptInstr_t& instr = instrs[pc++];
+    const hidl_vec<uint8_t>* last =
+        responses.empty() ? NULL : &responses.back();
+    apdu.clear();
+
+    if (instr.op == ScriptOp::EXIT) break;
+    if (instr.op == ScriptOp::ABORT) {
+      result = ScriptStatus::ABORTED;
+      break;
+    }
+    if (instr.op == ScriptOp::JUMP_IF_SW) {
+      uint16_t sw = getScriptU16(instr.payload);
+      uint16_t mask = getScriptU16(instr.payload + 2);
+      uint16_t lastSw = (last != NULL) ? getStatusWord(*last) : 0;
+      if ((lastSw & mask) == (sw & mask))
+        pc = getScriptU16(instr.payload + 4);
+      continue;
+    }
+    if (instr.op == ScriptOp::SEND) {
+      apdu.assign(instr.payload, instr.payload + instr.len);
+    } else if (instr.op == ScriptOp::SEND_COPY) {
+      uint16_t srcOff = getScriptU16(instr.payload);
+      uint16_t cpyLen = getScriptU16(instr.payload + 2);
+      uint16_t dstOff = getScriptU16(instr.payload + 4);
+      if ((last == NULL) || ((uint32_t)srcOff + cpyLen > last->size())) {
+        result = ScriptStatus::COPY_OUT_OF_RANGE;
+        break;
+      }
+      apdu.assign(instr.payload + SCRIPT_COPY_HEADER_LEN,
+                  instr.payload + instr.len);
+      if (cpyLen > 0) memcpy(&apdu[dstOff], &(*last)[srcOff], cpyLen);
+    } else {
+      /*GET_RESPONSE: only meaningful right after a 61xx*/
+      if ((last == NULL) || ((getStatusWord(*last) >> 8) != 0x61)) {
+        result = ScriptStatus::INVALID_SCRIPT;
+        break;
+      }
+      apdu = {lastCla, SCRIPT_INS_GET_RESPONSE, 0x00, 0x00,
+              (uint8_t)(getStatusWord(*last) & 0xFF)};
+    }
+
+    lastCla = apdu[0];
+    responses.emplace_back();
+    ESESTATUS status =
+        transceiveApdu(apdu.data(), apdu.size(), responses.back(), client);
+    if (status == ESESTATUS_NOT_ALLOWED) {
+      /*Not exchanged, the channel is held by another client*/
+      responses.pop_back();
+      result = ScriptStatus::CHANNEL_NOT_AVAILABLE;
+      break;
+    } else if (status != ESESTATUS_SUCCESS) {
+      result = ScriptStatus::TRANSMIT_FAILED;
+      break;
+    }
+  }
+
+  ALOGD_IF(result != ScriptStatus::SUCCESS,
+           "NxpEse::runScript(): stopped at instruction %zu status %d",
+           pc == 0 ? 0 : pc - 1, (int)result);
+  _hidl_cb(result, hidl_vec<hidl_vec<uint8_t>>(responses));
+  ALOGD("NxpEse::runScript(): exit exchanged=%zu", responses.size());
+  return Void();
+}
+
+/*Largest response of an APDU: extended if a zero byte follows the header
+ *and the APDU goes on*/
+static size_t getMaxResponseLen(const uint8_t* cmd, size_t len) {
+  if ((len > 5) && (cmd[4] == 0x00)) return RSP_MAX_EXTENDED_LEN;
+  return RSP_MAX_SHORT_LEN;
+}
+
+std::vector<std::shared_ptr<NxpEse::DataPath>>::iterator
+NxpEse::findDataPath(const sp<IBase>& token) {
+  auto it = mDataPaths.begin();
+  while ((it != mDataPaths.end()) && !interfacesEqual((*it)->token, token))
+    ++it;
+  return it;
+}
+
+Return<void> NxpEse::setupDataQueues(const sp<IBase>& token,
+                                     uint32_t queueSize,
+                                     setupDataQueues_cb _hidl_cb) {
+  ALOGD("NxpEse::setupDataQueues(): enter size=%u", queueSize);
+  std::lock_guard<std::mutex> lock(mDataQueueLock);
+  if (token == nullptr) {
+    ALOGE("NxpEse::setupDataQueues(): no token");
+    _hidl_cb(false, DataQueue::Descriptor(), DataQueue::Descriptor());
+    return Void();
+  }
+  /*Queues set up earlier by this client are replaced*/
+  auto it = findDataPath(token);
+  if (it != mDataPaths.end()) {
+    (*it)->token->unlinkToDeath(this);
+    mDataPaths.erase(it);
+  }
+
+  std::shared_ptr<DataPath> path = std::make_shared<DataPath>();
+  if (mDataPaths.size() >= DATA_PATH_MAX_CLIENTS) {
+    ALOGE("NxpEse::setupDataQueues(): too many clients");
+  } else if ((queueSize >= DATA_QUEUE_MIN_SIZE) &&
+             (queueSize <= DATA_QUEUE_MAX_SIZE)) {
+    path->cmdQueue.reset(new DataQueue(queueSize));
+    path->rspQueue.reset(new DataQueue(queueSize));
+    if (!path->cmdQueue->isValid() || !path->rspQueue->isValid()) {
+      ALOGE("NxpEse::setupDataQueues(): queue creation failed");
+      path->cmdQueue.reset();
+    }
+  } else {
+    ALOGE("NxpEse::setupDataQueues(): invalid size");
+  }
+
+  if (path->cmdQueue == nullptr) {
+    _hidl_cb(false, DataQueue::Descriptor(), DataQueue::Descriptor());
+    return Void();
+  }
+  path->token = token;
+  if (!token->linkToDeath(this, DEATH_COOKIE_DATA_PATH)) {
+    ALOGE("NxpEse::setupDataQueues(): failed to register death notification");
+  }
+  mDataPaths.push_back(path);
+  _hidl_cb(true, *path->cmdQueue->getDesc(), *path->rspQueue->getDesc());
+  return Void();
+}
+
+/*******************************************************************************
+**
+** Function:        takeCommand
+**
+** Description:     Takes the command APDU of cmdLen bytes from the queues of
+**                  the caller, which stay busy until releaseDataPath. The
+**                  command is left queued unless the response queue is
+**                  empty and can hold the largest response of the command.
+**                  Called with mDataQueueLock held.
+**
+** Returns:         queues of the caller, nullptr if it has none, they are
+**                  busy, or the command is invalid or cannot be answered
+**
+*******************************************************************************/
+std::shared_ptr<NxpEse::DataPath> NxpEse::takeCommand(
+    const sp<IBase>& token, uint32_t cmdLen, std::vector<uint8_t>& cmd) {
+  auto it = findDataPath(token);
+  if ((token == nullptr) || (it == mDataPaths.end())) {
+    ALOGE("NxpEse::takeCommand(): caller has no data path");
+    return nullptr;
+  }
+  std::shared_ptr<DataPath> path = *it;
+  if (path->busy) {
+    ALOGE("NxpEse::takeCommand(): transmit already in progress");
+    return nullptr;
+  }
+  DataQueue::MemTransaction tx;
+  if ((cmdLen < BATCH_MIN_APDU_LENGTH) ||
+      !path->cmdQueue->beginRead(cmdLen, &tx)) {
+    ALOGE("NxpEse::takeCommand(): invalid length");
+    return nullptr;
+  }
+  /*The header tells the largest response, the response must not be lost
+   *after the eSE executed the command*/
+  uint8_t header[5] = {0x00};
+  uint32_t headerLen = (cmdLen < sizeof(header)) ? cmdLen : sizeof(header);
+  if (!tx.copyFrom(header, 0, headerLen) ||
+      (path->rspQueue->availableToRead() != 0) ||
+      (path->rspQueue->availableToWrite() <
+       getMaxResponseLen(header, cmdLen))) {
+    ALOGE("NxpEse::takeCommand(): response queue not drained or too small");
+    return nullptr;
+  }
+  cmd.resize(cmdLen);
+  if (!tx.copyFrom(cmd.data(), 0, cmdLen) ||
+      !path->cmdQueue->commitRead(cmdLen)) {
+    ALOGE("NxpEse::takeCommand(): command read failed");
+    return nullptr;
+  }
+  path->busy = true;
+  return path;
+}
+
+/*Ends the transmit started by takeCommand*/
+void NxpEse::releaseDataPath(const std::shared_ptr<DataPath>& path) {
+  std::lock_guard<std::mutex> lock(mDataQueueLock);
+  path->busy = false;
+}
+
+Return<uint32_t> NxpEse::transmitFromQueue(const sp<IBase>& token,
+                                           uint32_t cmdLen) {
+  std::vector<uint8_t> cmd;
+  std::shared_ptr<DataPath> path;
+  {
+    std::lock_guard<std::mutex> lock(mDataQueueLock);
+    path = takeCommand(token, cmdLen, cmd);
+  }
+  if (path == nullptr) return 0;
+
+  /*The library refuses MANAGE CHANNEL and channels of other clients*/
+  hidl_vec<uint8_t> rsp;
+  uint32_t rspLen = 0;
+  ESESTATUS status =
+      transceiveApdu(cmd.data(), cmd.size(), rsp, getCallingClient());
+  if ((status != ESESTATUS_SUCCESS) && (status != ESESTATUS_WRITE_FAILED)) {
+    ALOGE("NxpEse::transmitFromQueue(): transmit failed status 0x%x", status);
+  } else if (!path->rspQueue->write(rsp.data(), rsp.size())) {
+    ALOGE("NxpEse::transmitFromQueue(): response of %zu bytes does not fit",
+          rsp.size());
+  } else {
+    rspLen = rsp.size();
+  }
+  releaseDataPath(path);
+  return rspLen;
+}
+
+/*Response queue state of a streamed transmit*/
+struct RspStream {
+  MessageQueue<uint8_t, kSynchronizedReadWrite>* queue;
+  uint32_t written;
+  bool overflow;
+};
+
+static void writeRspChunk(const uint8_t* p_data, uint32_t len, bool last,
+                          void* pContext) {
+  RspStream* stream = (RspStream*)pContext;
+  (void)last;
+  if (stream->overflow || (len == 0)) return;
+  if (!stream->queue->write(p_data, len)) {
+    stream->overflow = true;
+    return;
+  }
+  stream->written += len;
+}
+
+Return<uint32_t> NxpEse::transmitStreamFromQueue(const sp<IBase>& token,
+                                                 uint32_t cmdLen) {
+  std::vector<uint8_t> cmd;
+  std::shared_ptr<DataPath> path;
+  {
+    std::lock_guard<std::mutex> lock(mDataQueueLock);
+    path = takeCommand(token, cmdLen, cmd);
+  }
+  if (path == nullptr) return 0;
+
+  /*The library refuses MANAGE CHANNEL and channels of other clients*/
+  phNxpEse_data cmdData;
+  RspStream stream = {path->rspQueue.get(), 0, false};
+  uint32_t rspLen = 0;
+  cmdData.len = cmd.size();
+  cmdData.p_data = cmd.data();
+  ESESTATUS status = phNxpEse_TransceiveStream(getCallingClient(), &cmdData,
+                                               writeRspChunk, &stream);
+  if (status != ESESTATUS_SUCCESS) {
+    ALOGE("NxpEse::transmitStreamFromQueue(): transmit failed status 0x%x",
+          status);
+  } else if (stream.overflow) {
+    ALOGE("NxpEse::transmitStreamFromQueue(): response does not fit");
+  } else {
+    rspLen = stream.written;
+  }
+  releaseDataPath(path);
+  return rspLen;
+}
+
+Return<void> NxpEse::acquireLease(const sp<IBase>& token, uint32_t durationMs,
+                                  acquireLease_cb _hidl_cb) {
+  ALOGD("NxpEse::acquireLease(): enter duration=%u", durationMs);
+  uint64_t leaseId = 0;
+  if ((token == nullptr) || !phNxpEse_isOpen() ||
+      (phNxpEse_AcquireLease(durationMs, &leaseId) != ESESTATUS_SUCCESS)) {
+    ALOGE("NxpEse::acquireLease(): not granted");
+    _hidl_cb(false, 0);
+    return Void();
+  }
+  watchLease(token, leaseId, false);
+  _hidl_cb(true, leaseId);
+  return Void();
+}
+
+Return<void> NxpEse::acquirePriorityLease(const sp<IBase>& token,
+                                          uint32_t durationMs,
+                                          acquirePriorityLease_cb _hidl_cb) {
+  ALOGD("NxpEse::acquirePriorityLease(): enter duration=%u", durationMs);
+  uint64_t leaseId = 0;
+  if ((token == nullptr) || !phNxpEse_isOpen() ||
+      (phNxpEse_AcquirePrioLease(durationMs, &leaseId) != ESESTATUS_SUCCESS)) {
+    ALOGE("NxpEse::acquirePriorityLease(): not granted");
+    _hidl_cb(false, 0);
+    return Void();
+  }
+  watchLease(token, leaseId, true);
+  _hidl_cb(true, leaseId);
+  return Void();
+}
+
+/*******************************************************************************
+**
+** Function:        watchLease
+**
+** Description:     Ends leaseId when the binder of its holder dies. One
+**                  normal and one priority lease are watched at a time.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void NxpEse::watchLease(const sp<IBase>& token, uint64_t leaseId, bool prio) {
+  std::lock_guard<std::mutex> lock(mLeaseLock);
+  sp<IBase>& watched = prio ? mPrioToken : mLeaseToken;
+  /*A previous holder's lease has ended, stop watching its binder*/
+  if (watched != nullptr) watched->unlinkToDeath(this);
+  watched = token;
+  if (prio)
+    mPrioLeaseId = leaseId;
+  else
+    mLeaseId = leaseId;
+  if (!watched->linkToDeath(this, leaseId /*cookie*/)) {
+    ALOGE("NxpEse::watchLease(): failed to register death notification");
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        isLeaseHolder
+**
+** Description:     Checks that leaseId is a lease granted to token. Called
+**                  with mLeaseLock held.
+**
+** Returns:         true if token holds leaseId
+**
+*******************************************************************************/
+bool NxpEse::isLeaseHolder(const sp<IBase>& token, uint64_t leaseId) {
+  if ((leaseId == 0) || (token == nullptr)) return false;
+  if ((leaseId == mLeaseId) && (mLeaseToken != nullptr))
+    return interfacesEqual(token, mLeaseToken);
+  if ((leaseId == mPrioLeaseId) && (mPrioToken != nullptr))
+    return interfacesEqual(token, mPrioToken);
+  return false;
+}
+
+Return<bool> NxpEse::releaseLease(const sp<IBase>& token, uint64_t leaseId) {
+  ALOGD("NxpEse::releaseLease(): enter");
+  std::lock_guard<std::mutex> lock(mLeaseLock);
+  if (!isLeaseHolder(token, leaseId)) {
+    ALOGE("NxpEse::releaseLease(): caller does not hold the lease");
+    return false;
+  }
+  if (leaseId == mLeaseId) {
+    mLeaseToken->unlinkToDeath(this);
+    mLeaseToken = nullptr;
+    mLeaseId = 0;
+  } else {
+    mPrioToken->unlinkToDeath(this);
+    mPrioToken = nullptr;
+    mPrioLeaseId = 0;
+  }
+  return (phNxpEse_ReleaseLease(leaseId) == ESESTATUS_SUCCESS);
+}
+
+Return<void> NxpEse::transmitLeased(const sp<IBase>& token, uint64_t leaseId,
+                                    const hidl_vec<uint8_t>& data,
+                                    transmitLeased_cb _hidl_cb) {
+  hidl_vec<uint8_t> result;
+  bool holder = false;
+  {
+    std::lock_guard<std::mutex> lock(mLeaseLock);
+    holder = isLeaseHolder(token, leaseId);
+  }
+  if (!holder) {
+    ALOGE("NxpEse::transmitLeased(): caller does not hold the lease");
+  } else if (data.size() >= BATCH_MIN_APDU_LENGTH) {
+    /*The library refuses MANAGE CHANNEL and channels of other clients*/
+    ESESTATUS status = transceiveApdu(data.data(), data.size(), result,
+                                      getCallingClient(), leaseId);
+    if ((status != ESESTATUS_SUCCESS) && (status != ESESTATUS_WRITE_FAILED)) {
+      ALOGE("NxpEse::transmitLeased(): transmit failed status 0x%x", status);
+      result.resize(0);
+    }
+  }
+  _hidl_cb(result);
+  return Void();
+}
+
+Return<void> NxpEse::transmitDeferred(const hidl_vec<hidl_vec<uint8_t>>& apdus,
+                                      uint32_t maxDelayMs,
+                                      transmitDeferred_cb _hidl_cb) {
+  ALOGD("NxpEse::transmitDeferred(): enter count=%zu delay=%u", apdus.size(),
+        maxDelayMs);
+  hidl_vec<hidl_vec<uint8_t>> responses;
+
+  /*Logical channels do not outlive a power window, basic channel only*/
+  for (size_t i = 0; i < apdus.size(); i++) {
+    if ((apdus[i].size() < BATCH_MIN_APDU_LENGTH) ||
+        (getApduChannel(apdus[i][0]) != BASIC_CHANNEL) ||
+        (apdus[i][1] == SCRIPT_INS_MANAGE_CHANNEL)) {
+      ALOGE("NxpEse::transmitDeferred(): invalid APDU at index %zu", i);
+      _hidl_cb(responses);
+      return Void();
+    }
+  }
+  if ((apdus.size() == 0) ||
+      (phNxpEse_HoldPowerWindow(maxDelayMs) != ESESTATUS_SUCCESS)) {
+    ALOGE("NxpEse::transmitDeferred(): empty list or eSE not powered");
+    _hidl_cb(responses);
+    return Void();
+  }
+
+  uint32_t client = getCallingClient();
+  responses.resize(apdus.size());
+  size_t executed = 0;
+  while (executed < apdus.size()) {
+    /*The window may be shared with a SecureElement client using the basic
+     *channel, the library refuses to change its selection underneath it*/
+    ESESTATUS status =
+        transceiveApdu(apdus[executed].data(), apdus[executed].size(),
+                       responses[executed], client, 0, true);
+    if (status == ESESTATUS_NOT_ALLOWED) {
+      ALOGE("NxpEse::transmitDeferred(): basic channel held at index %zu",
+            executed);
+      break;
+    }
+    executed++;
+    if (status != ESESTATUS_SUCCESS) {
+      ALOGE("NxpEse::transmitDeferred(): transmit failed at index %zu",
+            executed - 1);
+      break;
+    }
+  }
+  phNxpEse_ReleasePowerWindow();
+  responses.resize(executed);
+  _hidl_cb(responses);
+  ALOGD("NxpEse::transmitDeferred(): exit executed=%zu", executed);
+  return Void();
+}
+
+Return<bool> NxpEse::registerCallback(const sp<INxpEseCallback>& callback) {
+  ALOGD("NxpEse::registerCallback(): enter");
+  if (callback == nullptr) return false;
+  phNxpEse_SpiAvailability_t state;
+  uint8_t felicaSessions = 0;
+  std::lock_guard<std::mutex> lock(sCallbackLock);
+  bool known = false;
+  for (const sp<INxpEseCallback>& cb : sCallbacks) {
+    if (interfacesEqual(cb, callback)) known = true;
+  }
+  /*A repeated registration only gets the current state again*/
+  if (!known) {
+    if (!callback->linkToDeath(this, DEATH_COOKIE_CALLBACK)) {
+      ALOGE("NxpEse::registerCallback(): failed to register death "
+            "notification");
+    }
+    sCallbacks.push_back(callback);
+  }
+  phNxpEse_SetSpiAvailabilityCallback(notifySpiAvailability);
+  phNxpEse_GetSpiAvailability(&state, &felicaSessions);
+  /*oneway, queued under the lock so that no later change is delivered
+   *before the initial state*/
+  callback->onSpiAvailabilityChanged((SpiAvailability)state, felicaSessions);
+  return true;
+}
+
+void NxpEse::serviceDied(uint64_t cookie, const wp<IBase>& who) {
+  if (cookie == DEATH_COOKIE_DATA_PATH) {
+    ALOGE("NxpEse::serviceDied(): data path owner died");
+    std::lock_guard<std::mutex> lock(mDataQueueLock);
+    for (auto it = mDataPaths.begin(); it != mDataPaths.end(); ++it) {
+      if (who == (*it)->token) {
+        mDataPaths.erase(it);
+        break;
+      }
+    }
+    return;
+  }
+  if (cookie == DEATH_COOKIE_CALLBACK) {
+    ALOGE("NxpEse::serviceDied(): callback owner died");
+    std::lock_guard<std::mutex> lock(sCallbackLock);
+    for (auto it = sCallbacks.begin(); it != sCallbacks.end(); ++it) {
+      if (who == *it) {
+        sCallbacks.erase(it);
+        break;
+      }
+    }
+    return;
+  }
+  ALOGE("NxpEse::serviceDied(): lease holder died");
+  std::lock_guard<std::mutex> lock(mLeaseLock);
+  if (cookie == mLeaseId) {
+    mLeaseToken = nullptr;
+    mLeaseId = 0;
+  } else if (cookie == mPrioLeaseId) {
+    mPrioToken = nullptr;
+    mPrioLeaseId = 0;
+  }
+  /*Lease id is the cookie, a lease that already ended is left alone*/
+  phNxpEse_ReleaseLease(cookie);
+}
+
 // Methods from ::android::hidl::base::V1_0::IBase follow.
 
 }  // namespace implementation
-}  // namespace V1_0
+}  // namespace V1_1
 }  // namespace nxpese
 }  // namespace nxp
 }  // namespace vendor
@@ -18,38 +18,99 @@
 #ifndef VENDOR_NXP_NXPNFC_V1_0_NXPNFC_H
 #define VENDOR_NXP_NXPNFC_V1_0_NXPNFC_H
 
+#include <fmq/MessageQueue.h>
 #include <hardware/hardware.h>
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
-#include <vendor/nxp/nxpese/1.0/INxpEse.h>
+#include <vendor/nxp/nxpese/1.1/INxpEse.h>
+#include <vendor/nxp/nxpese/1.1/INxpEseCallback.h>
 #include "hal_nxpese.h"
 #include "utils/Log.h"
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace vendor {
 namespace nxp {
 namespace nxpese {
-namespace V1_0 {
+namespace V1_1 {
 namespace implementation {
 
 using ::android::hidl::base::V1_0::DebugInfo;
 using ::android::hidl::base::V1_0::IBase;
-using ::vendor::nxp::nxpese::V1_0::INxpEse;
+using ::vendor::nxp::nxpese::V1_1::INxpEse;
+using ::vendor::nxp::nxpese::V1_1::INxpEseCallback;
 using ::android::hardware::hidl_array;
+using ::android::hardware::hidl_death_recipient;
 using ::android::hardware::hidl_memory;
 using ::android::hardware::hidl_string;
 using ::android::hardware::hidl_vec;
+using ::android::hardware::kSynchronizedReadWrite;
+using ::android::hardware::MessageQueue;
 using ::android::hardware::Return;
 using ::android::hardware::Void;
 using ::android::sp;
+using ::android::wp;
 
-struct NxpEse : public INxpEse {
+struct NxpEse : public INxpEse, public hidl_death_recipient {
   Return<void> ioctl(uint64_t ioctlType, const hidl_vec<uint8_t>& inOutData,
                      ioctl_cb _hidl_cb) override;
   Return<void> nfccNtf(uint64_t ntfType, const hidl_vec<uint8_t> &ntfData);
+  Return<void> transmitBatch(const hidl_vec<hidl_vec<uint8_t>>& apdus,
+                             bool stopOnError,
+                             transmitBatch_cb _hidl_cb) override;
+  Return<void> runScript(const hidl_vec<uint8_t>& script,
+                         runScript_cb _hidl_cb) override;
+  Return<void> setupDataQueues(const sp<IBase>& token, uint32_t queueSize,
+                               setupDataQueues_cb _hidl_cb) override;
+  Return<uint32_t> transmitFromQueue(const sp<IBase>& token,
+                                     uint32_t cmdLen) override;
+  Return<uint32_t> transmitStreamFromQueue(const sp<IBase>& token,
+                                           uint32_t cmdLen) override;
+  Return<void> acquireLease(const sp<IBase>& token, uint32_t durationMs,
+                            acquireLease_cb _hidl_cb) override;
+  Return<void> acquirePriorityLease(const sp<IBase>& token, uint32_t durationMs,
+                                    acquirePriorityLease_cb _hidl_cb) override;
+  Return<bool> releaseLease(const sp<IBase>& token, uint64_t leaseId) override;
+  Return<void> transmitLeased(const sp<IBase>& token, uint64_t leaseId,
+                              const hidl_vec<uint8_t>& data,
+                              transmitLeased_cb _hidl_cb) override;
+  Return<void> transmitDeferred(const hidl_vec<hidl_vec<uint8_t>>& apdus,
+                                uint32_t maxDelayMs,
+                                transmitDeferred_cb _hidl_cb) override;
+  Return<bool> registerCallback(const sp<INxpEseCallback>& callback) override;
+  void serviceDied(uint64_t cookie, const wp<IBase>& who) override;
+
+ private:
+  typedef MessageQueue<uint8_t, kSynchronizedReadWrite> DataQueue;
+  /*Queues of one client, keyed by the binder passed to setupDataQueues.
+   *A transmit in progress keeps them alive and busy.*/
+  struct DataPath {
+    sp<IBase> token;
+    std::unique_ptr<DataQueue> cmdQueue;
+    std::unique_ptr<DataQueue> rspQueue;
+    bool busy = false;
+  };
+  std::mutex mDataQueueLock;
+  std::vector<std::shared_ptr<DataPath>> mDataPaths;
+  std::mutex mLeaseLock;
+  sp<IBase> mLeaseToken;
+  uint64_t mLeaseId = 0;
+  /*A priority lease coexists with the lease it paused*/
+  sp<IBase> mPrioToken;
+  uint64_t mPrioLeaseId = 0;
+  void watchLease(const sp<IBase>& token, uint64_t leaseId, bool prio);
+  bool isLeaseHolder(const sp<IBase>& token, uint64_t leaseId);
+  std::vector<std::shared_ptr<DataPath>>::iterator findDataPath(
+      const sp<IBase>& token);
+  std::shared_ptr<DataPath> takeCommand(const sp<IBase>& token,
+                                        uint32_t cmdLen,
+                                        std::vector<uint8_t>& cmd);
+  void releaseDataPath(const std::shared_ptr<DataPath>& path);
 };
 
 }  // namespace implementation
-}  // namespace V1_0
+}  // namespace V1_1
 }  // namespace nxpese
 }  // namespace nxp
 }  // namespace vendor
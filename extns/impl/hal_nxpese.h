@@ -84,7 +84,15 @@ enum {
   HAL_NFC_IOCTL_SET_TRANSIT_CONFIG,
   HAL_NFC_IOCTL_NFCEE_SESSION_RESET,
   HAL_ESE_IOCTL_OMAPI_TRY_GET_ESE_SESSION,
-  HAL_ESE_IOCTL_OMAPI_RELEASE_ESE_SESSION
+  HAL_ESE_IOCTL_OMAPI_RELEASE_ESE_SESSION,
+  /*Sent by NFC HAL, values shared with it must never move*/
+  HAL_NFC_IOCTL_SPI_DWP_RELEASE_NTF = 37,
+  HAL_NFC_IOCTL_DWNLD_STATE_NTF = 38,
+  /*eSE HAL local ioctls*/
+  HAL_ESE_IOCTL_GET_LS_PROGRESS,
+  HAL_ESE_IOCTL_SET_AUTO_GET_RESPONSE,
+  HAL_ESE_IOCTL_GET_PRIO_STATS,
+  HAL_ESE_IOCTL_GET_RF_BLOCK_STATS
 };
 
 /*
@@ -135,6 +143,61 @@ typedef struct {
   long level;
 } ese_nxp_ExtnInputData_t;
 
+/*
+ * ese_nxp_LsProgress_t :Loader Service script execution progress returned
+ * for HAL_ESE_IOCTL_GET_LS_PROGRESS. Record total and ETA are estimated from
+ * the part of the script parsed so far.
+ */
+enum {
+  LS_PROGRESS_STATE_IDLE = 0,
+  LS_PROGRESS_STATE_RUNNING,
+  LS_PROGRESS_STATE_DONE,
+  LS_PROGRESS_STATE_FAILED
+};
+typedef struct {
+  uint8_t scriptIndex; /* LS script slot, 0 if none executed yet */
+  uint8_t state;
+  uint32_t recordsDone;
+  uint32_t recordsTotal;
+  uint32_t apduCount;
+  uint32_t bytesSent;
+  uint32_t avgLatencyUs;
+  uint32_t p99LatencyUs;
+  uint32_t wtxCount;
+  uint32_t elapsedMs;
+  uint32_t etaMs;
+} ese_nxp_LsProgress_t;
+
+/*
+ * ese_nxp_PrioStats_t :priority lease statistics returned for
+ * HAL_ESE_IOCTL_GET_PRIO_STATS. Time-to-device is the time from the request
+ * until the eSE was handed to the priority lease holder.
+ */
+typedef struct {
+  uint32_t grantCount;
+  uint32_t timeoutCount;
+  uint32_t preemptCount;
+  uint32_t avgWaitMs;
+  uint32_t maxWaitMs;
+} ese_nxp_PrioStats_t;
+
+/*
+ * ese_nxp_RfBlockStats_t :time transceive callers spent held while SPI was
+ * suspended for active RF, returned for HAL_ESE_IOCTL_GET_RF_BLOCK_STATS.
+ * failCount counts the callers still suspended when they gave up. state is
+ * the current SpiAvailability, ntfCount the changes published so far.
+ */
+typedef struct {
+  uint32_t blockCount;
+  uint32_t failCount;
+  uint32_t avgBlockMs;
+  uint32_t maxBlockMs;
+  uint64_t totalBlockMs;
+  uint8_t state;
+  uint8_t felicaSessions;
+  uint32_t ntfCount;
+} ese_nxp_RfBlockStats_t;
+
 /*
  * outputData_t :ioctl has multiple commands/responses
  * This contains the output types for each ioctl.
@@ -148,6 +211,9 @@ typedef union {
   uint16_t fwDwnldStatus;
   uint16_t fwMwVerStatus;
   uint8_t chipType;
+  ese_nxp_LsProgress_t lsProgress;
+  ese_nxp_PrioStats_t prioStats;
+  ese_nxp_RfBlockStats_t rfBlockStats;
 } eseOutputData_t;
 
 /*
@@ -55,6 +55,73 @@ typedef struct phNxpEse_initParams {
   phNxpEse_initMode initMode; /*!< Ese communication mode */
 } phNxpEse_initParams;
 
+/*!
+ * \brief Buckets of the arbitration wait histograms. Bucket 0 counts waits
+ *        of 0 ms, bucket i waits of [2^(i-1), 2^i) ms and the last bucket
+ *        all longer waits.
+ */
+#define ESE_ARB_WAIT_BUCKETS 12
+
+/**
+ * \ingroup spi_libese
+ * \brief Foreground (OMAPI) / background (Loader Service) transceive
+ *        arbitration statistics
+ *
+ */
+typedef struct phNxpEse_ArbStats {
+  uint32_t bgApduCount;   /*!< APDUs exchanged by background clients */
+  uint32_t bgYieldCount;  /*!< times background yielded to foreground */
+  uint64_t bgYieldTimeMs; /*!< time background spent yielding/throttled */
+  uint32_t fgApduCount;   /*!< APDUs exchanged by foreground clients */
+  uint32_t fgWaitCount;   /*!< times foreground waited for background APDU */
+  uint64_t fgWaitTimeMs;  /*!< total foreground wait time */
+  uint32_t fgWaitMaxMs;   /*!< worst case foreground wait time */
+  uint32_t fgWaitHist[ESE_ARB_WAIT_BUCKETS];  /*!< foreground waits */
+  uint32_t bgYieldHist[ESE_ARB_WAIT_BUCKETS]; /*!< background yields */
+  uint32_t leaseCount;    /*!< exclusive leases granted */
+  uint32_t leaseApduCount; /*!< APDUs exchanged under a lease */
+  uint64_t leaseWaitTimeMs; /*!< time other clients waited for leases */
+  uint32_t prioCount;        /*!< priority leases granted */
+  uint32_t prioTimeoutCount; /*!< priority leases refused, eSE not freed */
+  uint32_t prioPreemptCount; /*!< leases paused by a priority lease */
+  uint64_t prioWaitTimeMs;   /*!< total priority lease time-to-device */
+  uint32_t prioWaitMaxMs;    /*!< worst priority lease time-to-device */
+  uint32_t rfBlockCount;     /*!< transceives held while RF was active */
+  uint32_t rfBlockFailCount; /*!< of these, SPI still suspended at the end */
+  uint64_t rfBlockTimeMs;    /*!< total time transceives were held */
+  uint32_t rfBlockMaxMs;     /*!< longest time a transceive was held */
+} phNxpEse_ArbStats_t;
+
+/*!
+ * \brief SPI availability as published to the SPI availability callback
+ *
+ */
+typedef enum {
+  ESE_SPI_AVAILABLE = 0,     /*!< APDUs are exchanged without delay */
+  ESE_SPI_RF_BUSY,           /*!< RF active, APDUs wait for RF off */
+  ESE_SPI_RF_BUSY_FELICA     /*!< RF active with a Felica app session */
+} phNxpEse_SpiAvailability_t;
+
+/*!
+ * \brief Callback reporting SPI availability changes, felicaSessions is the
+ *        number of open Felica app sessions
+ *
+ */
+typedef void (*phNxpEse_SpiAvailabilityCb_t)(
+    phNxpEse_SpiAvailability_t state, uint8_t felicaSessions);
+
+/*!
+ * \brief Power window statistics of deferrable requests
+ *
+ */
+typedef struct phNxpEse_PwrWindowStats {
+  uint32_t requestCount; /*!< deferrable requests */
+  uint32_t joinedCount;  /*!< requests served in an already open window */
+  uint32_t openedCount;  /*!< windows opened for deferrable requests */
+  uint32_t adoptedCount; /*!< scheduler windows taken over by foreground */
+  uint64_t delayTimeMs;  /*!< total time requests waited for a window */
+} phNxpEse_PwrWindowStats_t;
+
 /*!
  * \brief SEAccess kit MW Android version
  */
@@ -102,6 +169,29 @@ bool phNxpEse_isOpen();
  ******************************************************************************/
 ESESTATUS phNxpEse_spiIoctl(uint64_t ioctlType, void* p_data);
 
+/******************************************************************************
+ * \ingroup spi_libese
+ *
+ * \brief  This function registers the function called on RF on, RF off
+ *         after debounce and Felica app session changes. It is called
+ *         from NFC HAL notification and timer threads and must not block.
+ *
+ * \retval None
+ *
+ ******************************************************************************/
+void phNxpEse_SetSpiAvailabilityCallback(phNxpEse_SpiAvailabilityCb_t pCb);
+
+/******************************************************************************
+ * \ingroup spi_libese
+ *
+ * \brief  This function returns the last published SPI availability
+ *
+ * \retval Number of availability changes published so far
+ *
+ ******************************************************************************/
+uint32_t phNxpEse_GetSpiAvailability(phNxpEse_SpiAvailability_t* pState,
+                                     uint8_t* pFelicaSessions);
+
 /**
  * \ingroup spi_libese
  * \brief This function is called by Jni during the
@@ -305,6 +395,318 @@ void phNxpEse_free(void* ptr);
 +*/
 ESESTATUS phNxpEse_DisablePwrCntrl(void);
 
+/**
+ * \ingroup spi_libese
+ * \brief This function is used by background clients (Loader Service) to
+ *        exchange an APDU. Before sending, it yields to pending foreground
+ *        (OMAPI) transceive requests and afterwards applies the configured
+ *        background duty cycle.
+ *
+ * \param[in]       phNxpEse_data: Command to ESE
+ * \param[out]     phNxpEse_data: Response from ESE (Returned data to be freed
+ *after copying)
+ *
+ * \retval ESESTATUS_SUCCESS On Success ESESTATUS_SUCCESS else proper error code
+ *
+ */
+ESESTATUS phNxpEse_BgTransceive(phNxpEse_data* pCmd, phNxpEse_data* pRsp);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function is used by foreground clients to exchange an APDU.
+ *        On channels with automatic response handling enabled it chains
+ *        GET RESPONSE on 61xx (up to NXP_AUTO_GET_RESPONSE_MAX_LEN bytes)
+ *        and re-sends once with the corrected Le on 6Cxx, so the final
+ *        payload is returned in one call. Otherwise same as
+ *        phNxpEse_Transceive. With a time budget, waits for other clients,
+ *        RF-off, the response, WTX and recovery all stop at the deadline.
+ *
+ * \param[in]       phNxpEse_data: Command to ESE
+ * \param[out]     phNxpEse_data: Response from ESE (Returned data to be freed
+ *after copying)
+ * \param[in]       uint32_t: time budget in ms for all exchanges, 0 for none
+ *
+ * \retval ESESTATUS_SUCCESS On Success, ESESTATUS_RESPONSE_TIMEOUT if the
+ *         deadline passed before the first response, else proper error code
+ *
+ */
+ESESTATUS phNxpEse_TransceiveAutoResp(phNxpEse_data* pCmd,
+                                      phNxpEse_data* pRsp,
+                                      uint32_t timeoutMs);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function enables or disables automatic 61xx/6Cxx handling
+ *        for a logical channel at runtime. Channels enabled through
+ *        NXP_AUTO_GET_RESPONSE stay enabled.
+ *
+ * \param[in]       uint8_t: logical channel number
+ * \param[in]       bool: true to enable
+ *
+ * \retval ESESTATUS_SUCCESS or ESESTATUS_INVALID_PARAMETER
+ *
+ */
+ESESTATUS phNxpEse_SetAutoGetResponse(uint8_t channel, bool enable);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function records the client holding a logical channel
+ *        through SecureElement. Exchanges checked against an owner are
+ *        refused on channels held by another client.
+ *
+ * \param[in]       uint8_t: logical channel number
+ * \param[in]       uint32_t: owner (client pid), 0 when released
+ *
+ * \retval ESESTATUS_SUCCESS or ESESTATUS_INVALID_PARAMETER
+ *
+ */
+ESESTATUS phNxpEse_SetChannelOwner(uint8_t channel, uint32_t owner);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function is used by extension clients to exchange an APDU
+ *        like phNxpEse_Transceive, on behalf of owner. MANAGE CHANNEL, and
+ *        channels other than the ones owner holds or the unheld basic
+ *        channel, are refused. The check is part of the exchange, channel
+ *        owners do not change until it completes.
+ *
+ * \param[in]       uint32_t: owner (client pid)
+ * \param[in]       phNxpEse_data: Command to ESE
+ * \param[out]     phNxpEse_data: Response from ESE (Returned data to be freed
+ *after copying)
+ *
+ * \retval ESESTATUS_SUCCESS, ESESTATUS_NOT_ALLOWED if the APDU was refused
+ *         else proper error code
+ *
+ */
+ESESTATUS phNxpEse_ClientTransceive(uint32_t owner, phNxpEse_data* pCmd,
+                                    phNxpEse_data* pRsp);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function is used by extension clients to exchange an APDU
+ *        like phNxpEse_BgTransceive, the channel is checked as by
+ *        phNxpEse_ClientTransceive.
+ *
+ * \param[in]       uint32_t: owner (client pid)
+ * \param[in]       phNxpEse_data: Command to ESE
+ * \param[out]     phNxpEse_data: Response from ESE (Returned data to be freed
+ *after copying)
+ *
+ * \retval ESESTATUS_SUCCESS, ESESTATUS_NOT_ALLOWED if the APDU was refused
+ *         else proper error code
+ *
+ */
+ESESTATUS phNxpEse_BgClientTransceive(uint32_t owner, phNxpEse_data* pCmd,
+                                      phNxpEse_data* pRsp);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function marks cached knowledge about the eSE applets, such
+ *        as SELECT results, as stale. Called internally on resets and card
+ *        content management APDUs, and by clients that changed the eSE
+ *        content by other means (e.g. Loader Service).
+ *
+ * \retval None
+ *
+ */
+void phNxpEse_InvalidateContent(void);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function returns the eSE content generation. Caches of eSE
+ *        state compare it with the value they were filled at.
+ *
+ * \retval Content generation
+ *
+ */
+uint32_t phNxpEse_GetContentGeneration(void);
+
+/**
+ * \ingroup spi_libese
+ * \brief Streaming response sink. Called for each response chunk (the
+ *        information field of a received I-frame) once the eSE has been
+ *        acknowledged for it, last is true for the final chunk. Chunks of a
+ *        transceive that fails must be discarded by the consumer.
+ *
+ */
+typedef void (*phNxpEse_RspChunkCb_t)(const uint8_t* p_data, uint32_t len,
+                                      bool last, void* pContext);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function is used by foreground clients to exchange an APDU
+ *        whose response is delivered chunk by chunk to pCb while the eSE
+ *        is still sending chained I-frames, instead of being assembled.
+ *        The channel is checked as by phNxpEse_ClientTransceive unless
+ *        owner is 0.
+ *
+ * \param[in]       uint32_t: owner (client pid), 0 for no check
+ * \param[in]       phNxpEse_data: Command to ESE
+ * \param[in]       phNxpEse_RspChunkCb_t: response sink, must not block
+ * \param[in]       void*: context passed to the sink
+ *
+ * \retval ESESTATUS_SUCCESS On Success ESESTATUS_SUCCESS else proper error code
+ *
+ */
+ESESTATUS phNxpEse_TransceiveStream(uint32_t owner, phNxpEse_data* pCmd,
+                                    phNxpEse_RspChunkCb_t pCb,
+                                    void* pContext);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function grants the caller exclusive eSE access until
+ *        phNxpEse_ReleaseLease or the deadline, whichever comes first.
+ *        Foreground requests already pending are served first, other
+ *        foreground and background transceives wait meanwhile.
+ *
+ * \param[in]       uint32_t: lease duration in ms, capped at
+ *                  ESE_LEASE_MAX_TIME
+ * \param[out]      uint64_t: lease id for phNxpEse_LeaseTransceive
+ *
+ * \retval ESESTATUS_SUCCESS, or ESESTATUS_BUSY if the eSE could not be
+ *         acquired in time
+ *
+ */
+ESESTATUS phNxpEse_AcquireLease(uint32_t durationMs, uint64_t* pLeaseId);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function grants a priority lease. Other clients are held at
+ *        their next APDU boundary and an active lease is paused until the
+ *        priority lease ends, then resumes with its remaining time.
+ *
+ * \param[in]       uint32_t: lease duration in ms, capped at
+ *                  ESE_LEASE_MAX_TIME
+ * \param[out]      uint64_t: lease id for phNxpEse_LeaseTransceive
+ *
+ * \retval ESESTATUS_SUCCESS, or ESESTATUS_BUSY if the APDU in flight did
+ *         not complete within NXP_PRIO_MAX_WAIT_TIME
+ *
+ */
+ESESTATUS phNxpEse_AcquirePrioLease(uint32_t durationMs, uint64_t* pLeaseId);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function ends a lease granted by phNxpEse_AcquireLease.
+ *
+ * \param[in]       uint64_t: lease id
+ *
+ * \retval ESESTATUS_SUCCESS, or ESESTATUS_INVALID_PARAMETER if the lease
+ *         is not the active one
+ *
+ */
+ESESTATUS phNxpEse_ReleaseLease(uint64_t leaseId);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function exchanges an APDU under an active lease without
+ *        foreground/background arbitration. The channel is checked as by
+ *        phNxpEse_ClientTransceive unless owner is 0.
+ *
+ * \param[in]       uint64_t: lease id
+ * \param[in]       uint32_t: owner (client pid), 0 for no check
+ * \param[in]       phNxpEse_data: Command to ESE
+ * \param[out]     phNxpEse_data: Response from ESE (Returned data to be freed
+ *after copying)
+ *
+ * \retval ESESTATUS_SUCCESS, ESESTATUS_NOT_ALLOWED if the lease is not
+ *         active (released or past its deadline) or the APDU was refused
+ *         else proper error code
+ *
+ */
+ESESTATUS phNxpEse_LeaseTransceive(uint64_t leaseId, uint32_t owner,
+                                   phNxpEse_data* pCmd, phNxpEse_data* pRsp);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function is used to read the foreground/background transceive
+ *        arbitration statistics
+ *
+ * \param[out]      phNxpEse_ArbStats_t: statistics snapshot
+ *
+ * \retval None
+ *
+ */
+void phNxpEse_GetArbStats(phNxpEse_ArbStats_t* pStats);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function is used by deferrable (background) requests to get
+ *        the eSE powered. It joins the open session, or waits up to the
+ *        request latency tolerance for another client to open one and then
+ *        opens a session shared with the other deferrable requests.
+ *
+ * \param[in]       uint32_t: latency tolerance in ms, capped at
+ *                  ESE_PWR_WINDOW_MAX_DELAY
+ *
+ * \retval ESESTATUS_SUCCESS if the eSE session is usable until
+ *         phNxpEse_ReleasePowerWindow, else proper error code
+ *
+ */
+ESESTATUS phNxpEse_HoldPowerWindow(uint32_t maxDelayMs);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function ends a request started by phNxpEse_HoldPowerWindow
+ *
+ * \retval None
+ *
+ */
+void phNxpEse_ReleasePowerWindow(void);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function checks whether the open session belongs to the power
+ *        window scheduler, so a foreground client must adopt it first
+ *
+ * \retval true for a scheduler owned session
+ *
+ */
+bool phNxpEse_isDeferredWindow(void);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function transfers a session opened by the power window
+ *        scheduler to the foreground client
+ *
+ * \retval true if the session was adopted, false if the client must open
+ *         its own session
+ *
+ */
+bool phNxpEse_AdoptPowerWindow(void);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function transfers the foreground session to the power window
+ *        scheduler while deferrable requests still use it
+ *
+ * \retval true if the session was handed over and must not be closed
+ *
+ */
+bool phNxpEse_HandOverPowerWindow(void);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function is used to read the power window statistics
+ *
+ * \param[out]      phNxpEse_PwrWindowStats_t: statistics snapshot
+ *
+ * \retval None
+ *
+ */
+void phNxpEse_GetPwrWindowStats(phNxpEse_PwrWindowStats_t* pStats);
+
+/**
+ * \ingroup spi_libese
+ * \brief This function is used to get the number of WTX requests received
+ *        from ESE since the library was loaded
+ *
+ * \retval Cumulative WTX count
+ *
+ */
+uint32_t phNxpEse_GetWtxCount(void);
+
 /**
  * \ingroup spi_libese
  * \brief This function is used to get the ESE timer status
@@ -23,6 +23,30 @@
 #include <phNxpEseProto7816_3.h>
 
 SyncEvent gSpiTxLock;
+/* WTX requests received since library load, never reset */
+static uint32_t gWtxTotalCount = 0;
+/* Response sink of a streaming transceive, NULL when the response is
+ * assembled through phNxpEse_GetData */
+static phNxpEse_RspChunkCb_t gRspChunkCb = NULL;
+static void* gRspChunkCtx = NULL;
+/* Last received I-frame, handed to the sink once it is acknowledged */
+static uint8_t gRspChunk[PH_PROTO_7816_MAX_INF_LEN];
+static uint32_t gRspChunkLen = 0;
+static bool gRspChunkPending = false;
+/* An exchange was abandoned at its deadline, the eSE may still answer it */
+static bool gResyncPending = false;
+/* The last session ended with a successful END OF APDU and the eSE was not
+ * reset since, its protocol state still matches ours */
+static bool gWarmState = false;
+/* Opened warm without any exchange, the first transceive verifies it */
+static bool gWarmUnverified = false;
+/* Recovery outcome per error type since library load, and the error episode
+ * in progress (PH_PROTO_7816_ERR_MAX when the link is healthy) */
+static phNxpEseProto7816_RecoveryStats_t gRecoveryStats[PH_PROTO_7816_ERR_MAX];
+static uint8_t gRecoveryPolicy = PH_PROTO_7816_RECOVERY_FIXED;
+static uint8_t gRecoveryErr = PH_PROTO_7816_ERR_MAX;
+static uint8_t gRecoveryTier = PH_PROTO_7816_TIER_RETRY;
+static bool gRecoverySkipRetry = false;
 
 extern bool ese_debug_enabled;
 extern bool gMfcAppSessionCount;
@@ -48,8 +72,13 @@ static ESESTATUS phNxpEseProto7816_SetFirstIframeContxt(void);
 static ESESTATUS phNxpEseProto7816_SetNextIframeContxt(void);
 static ESESTATUS phNxpEseProro7816_SaveIframeData(uint8_t* p_data,
                                                   uint32_t data_len);
+static void phNxpEseProto7816_FlushRspChunk(bool last);
+static void phNxpEseProto7816_ResyncIfPending(void);
 static ESESTATUS phNxpEseProto7816_ResetRecovery(void);
 static ESESTATUS phNxpEseProto7816_RecoverySteps(void);
+static void phNxpEseProto7816_RecoveryStart(uint8_t errType);
+static bool phNxpEseProto7816_RecoveryRetry(uint8_t errType, bool delay);
+static void phNxpEseProto7816_RecoveryEnd(bool recovered);
 static ESESTATUS phNxpEseProto7816_DecodeFrame(uint8_t* p_data,
                                                uint32_t data_len);
 static ESESTATUS phNxpEseProto7816_ProcessResponse(void);
@@ -411,6 +440,33 @@ static ESESTATUS phNxpEseProto7816_SetNextIframeContxt(void) {
   return ESESTATUS_SUCCESS;
 }
 
+/******************************************************************************
+ * Function         phNxpEseProto7816_ResyncIfPending
+ *
+ * Description      This internal function resynchronizes the T=1 sequence
+ *                  numbers after an exchange was abandoned at its deadline
+ *                  and drops a late response of that exchange
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+static void phNxpEseProto7816_ResyncIfPending(void) {
+  phNxpEse_RspChunkCb_t rspChunkCb = gRspChunkCb;
+  uint32_t data_len = 0;
+  uint8_t* p_data = NULL;
+  if (!gResyncPending) return;
+  gResyncPending = false;
+  ALOGD_IF(ese_debug_enabled, "%s resync after abandoned exchange",
+           __FUNCTION__);
+  gRspChunkCb = NULL;
+  if (ESESTATUS_SUCCESS != phNxpEseProto7816_RSync()) {
+    ALOGE("%s RSync failed", __FUNCTION__);
+  }
+  gRspChunkCb = rspChunkCb;
+  if (ESESTATUS_SUCCESS == phNxpEse_GetData(&data_len, &p_data))
+    phNxpEse_free(p_data);
+}
+
 /******************************************************************************
  * Function         phNxpEseProto7816_ResetRecovery
  *
@@ -430,7 +486,13 @@ static ESESTATUS phNxpEseProro7816_SaveIframeData(uint8_t* p_data,
   }
   ALOGD_IF(ese_debug_enabled, "Data[0]=0x%x len=%d Data[%d]=0x%x", p_data[0],
            data_len, data_len - 1, p_data[data_len - 1]);
-  if (ESESTATUS_SUCCESS != phNxpEse_StoreDatainList(data_len, p_data)) {
+  if (gRspChunkCb != NULL) {
+    /* Streaming: held until the frame is acknowledged */
+    if (data_len > sizeof(gRspChunk)) return ESESTATUS_FAILED;
+    phNxpEse_memcpy(gRspChunk, p_data, data_len);
+    gRspChunkLen = data_len;
+    gRspChunkPending = true;
+  } else if (ESESTATUS_SUCCESS != phNxpEse_StoreDatainList(data_len, p_data)) {
     ALOGE("%s - Error storing chained data in list", __FUNCTION__);
     status = ESESTATUS_FAILED;
   }
@@ -438,6 +500,23 @@ static ESESTATUS phNxpEseProro7816_SaveIframeData(uint8_t* p_data,
   return status;
 }
 
+/******************************************************************************
+ * Function         phNxpEseProto7816_FlushRspChunk
+ *
+ * Description      This internal function hands the pending received I-frame
+ *                  data to the streaming response sink
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+static void phNxpEseProto7816_FlushRspChunk(bool last) {
+  if ((gRspChunkCb == NULL) || (!gRspChunkPending && !last)) return;
+  gRspChunkCb(gRspChunk, gRspChunkPending ? gRspChunkLen : 0, last,
+              gRspChunkCtx);
+  gRspChunkPending = false;
+  gRspChunkLen = 0;
+}
+
 /******************************************************************************
  * Function         phNxpEseProto7816_ResetRecovery
  *
@@ -449,9 +528,85 @@ static ESESTATUS phNxpEseProro7816_SaveIframeData(uint8_t* p_data,
  ******************************************************************************/
 static ESESTATUS phNxpEseProto7816_ResetRecovery(void) {
   phNxpEseProto7816_3_Var.recoveryCounter = 0;
+  phNxpEseProto7816_RecoveryEnd(true);
   return ESESTATUS_SUCCESS;
 }
 
+/******************************************************************************
+ * Function         phNxpEseProto7816_RecoveryStart
+ *
+ * Description      This internal function is called on every error. The first
+ *                  error after a healthy exchange starts an error episode and
+ *                  decides, from the statistics of its type, whether the
+ *                  retry tier is worth trying.
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+static void phNxpEseProto7816_RecoveryStart(uint8_t errType) {
+  if (gRecoveryErr != PH_PROTO_7816_ERR_MAX) return;
+  phNxpEseProto7816_RecoveryStats_t* pStats = &gRecoveryStats[errType];
+  gRecoveryErr = errType;
+  gRecoveryTier = PH_PROTO_7816_TIER_RETRY;
+  pStats->episodes++;
+  /* LRC and timeout errors have no in-stack tier to escalate to */
+  gRecoverySkipRetry =
+      (gRecoveryPolicy == PH_PROTO_7816_RECOVERY_ADAPTIVE) &&
+      (errType != PH_PROTO_7816_ERR_LRC) &&
+      (errType != PH_PROTO_7816_ERR_TIMEOUT) &&
+      (pStats->attempts[PH_PROTO_7816_TIER_RETRY] >=
+       PH_PROTO_7816_RECOVERY_MIN_SAMPLES) &&
+      ((pStats->recovered[PH_PROTO_7816_TIER_RETRY] * 100) <
+       (pStats->attempts[PH_PROTO_7816_TIER_RETRY] *
+        PH_PROTO_7816_RECOVERY_MIN_SUCCESS)) &&
+      ((pStats->episodes % PH_PROTO_7816_RECOVERY_PROBE_INTERVAL) != 0);
+  if (gRecoverySkipRetry) {
+    ALOGD_IF(ese_debug_enabled, "%s error %d: retries never help, skipped",
+             __FUNCTION__, errType);
+  } else {
+    pStats->attempts[PH_PROTO_7816_TIER_RETRY]++;
+  }
+}
+
+/******************************************************************************
+ * Function         phNxpEseProto7816_RecoveryRetry
+ *
+ * Description      This internal function records an error and tells whether
+ *                  the frame shall be retried or the recovery escalated. The
+ *                  DELAY_ERROR_RECOVERY wait is only taken when retrying.
+ *
+ * Returns          true to retry, false to escalate
+ *
+ ******************************************************************************/
+static bool phNxpEseProto7816_RecoveryRetry(uint8_t errType, bool delay) {
+  phNxpEseProto7816_RecoveryStart(errType);
+  if ((gRecoverySkipRetry) || (phNxpEseProto7816_3_Var.recoveryCounter >=
+                               PH_PROTO_7816_FRAME_RETRY_COUNT)) {
+    return false;
+  }
+  if (delay) phNxpEse_Sleep(DELAY_ERROR_RECOVERY);
+  return true;
+}
+
+/******************************************************************************
+ * Function         phNxpEseProto7816_RecoveryEnd
+ *
+ * Description      This internal function closes the error episode in
+ *                  progress and credits the tier it ended at
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+static void phNxpEseProto7816_RecoveryEnd(bool recovered) {
+  if (gRecoveryErr == PH_PROTO_7816_ERR_MAX) return;
+  if (recovered) gRecoveryStats[gRecoveryErr].recovered[gRecoveryTier]++;
+  ALOGD_IF(ese_debug_enabled, "%s error %d %s at tier %d", __FUNCTION__,
+           gRecoveryErr, recovered ? "recovered" : "not recovered",
+           gRecoveryTier);
+  gRecoveryErr = PH_PROTO_7816_ERR_MAX;
+  gRecoverySkipRetry = false;
+}
+
 /******************************************************************************
  * Function         phNxpEseProto7816_RecoverySteps
  *
@@ -466,6 +621,11 @@ static ESESTATUS phNxpEseProto7816_ResetRecovery(void) {
 static ESESTATUS phNxpEseProto7816_RecoverySteps(void) {
   if (phNxpEseProto7816_3_Var.recoveryCounter <=
       PH_PROTO_7816_FRAME_RETRY_COUNT) {
+    if ((gRecoveryErr != PH_PROTO_7816_ERR_MAX) &&
+        (gRecoveryTier == PH_PROTO_7816_TIER_RETRY)) {
+      gRecoveryTier = PH_PROTO_7816_TIER_INTF_RESET;
+      gRecoveryStats[gRecoveryErr].attempts[gRecoveryTier]++;
+    }
     phNxpEseProto7816_3_Var.phNxpEseRx_Cntx.lastRcvdSframeInfo.sFrameType =
         INTF_RESET_REQ;
     phNxpEseProto7816_3_Var.phNxpEseNextTx_Cntx.FrameType = SFRAME;
@@ -618,9 +778,7 @@ static ESESTATUS phNxpEseProto7816_DecodeFrame(uint8_t* p_data,
         status = phNxpEseProro7816_SaveIframeData(&p_data[3], data_len - 4);
       }
     } else {
-      phNxpEse_Sleep(DELAY_ERROR_RECOVERY);
-      if (phNxpEseProto7816_3_Var.recoveryCounter <
-          PH_PROTO_7816_FRAME_RETRY_COUNT) {
+      if (phNxpEseProto7816_RecoveryRetry(PH_PROTO_7816_ERR_SEQ, true)) {
         phNxpEseProto7816_3_Var.phNxpEseNextTx_Cntx.FrameType = RFRAME;
         phNxpEseProto7816_3_Var.phNxpEseNextTx_Cntx.RframeInfo.errCode =
             OTHER_ERROR;
@@ -660,15 +818,13 @@ static ESESTATUS phNxpEseProto7816_DecodeFrame(uint8_t* p_data,
     else if (((pcb_bits.lsb == 0x01) && (pcb_bits.bit2 == 0x00)) ||
              /* Error handling 2: Other indicated error */
              ((pcb_bits.lsb == 0x00) && (pcb_bits.bit2 == 0x01))) {
-      phNxpEse_Sleep(DELAY_ERROR_RECOVERY);
       if ((pcb_bits.lsb == 0x00) && (pcb_bits.bit2 == 0x01))
         phNxpEseProto7816_3_Var.phNxpEseRx_Cntx.lastRcvdRframeInfo.errCode =
             OTHER_ERROR;
       else
         phNxpEseProto7816_3_Var.phNxpEseRx_Cntx.lastRcvdRframeInfo.errCode =
             PARITY_ERROR;
-      if (phNxpEseProto7816_3_Var.recoveryCounter <
-          PH_PROTO_7816_FRAME_RETRY_COUNT) {
+      if (phNxpEseProto7816_RecoveryRetry(PH_PROTO_7816_ERR_RNACK, true)) {
         if (phNxpEseProto7816_3_Var.phNxpEseLastTx_Cntx.FrameType == IFRAME) {
           phNxpEse_memcpy(&phNxpEseProto7816_3_Var.phNxpEseNextTx_Cntx,
                           &phNxpEseProto7816_3_Var.phNxpEseLastTx_Cntx,
@@ -733,9 +889,7 @@ static ESESTATUS phNxpEseProto7816_DecodeFrame(uint8_t* p_data,
     }
     /* Error handling 3 */
     else if ((pcb_bits.lsb == 0x01) && (pcb_bits.bit2 == 0x01)) {
-      phNxpEse_Sleep(DELAY_ERROR_RECOVERY);
-      if (phNxpEseProto7816_3_Var.recoveryCounter <
-          PH_PROTO_7816_FRAME_RETRY_COUNT) {
+      if (phNxpEseProto7816_RecoveryRetry(PH_PROTO_7816_ERR_SOF, true)) {
         phNxpEseProto7816_3_Var.phNxpEseRx_Cntx.lastRcvdRframeInfo.errCode =
             SOF_MISSED_ERROR;
         phNxpEseProto7816_3_Var.phNxpEseNextTx_Cntx =
@@ -747,9 +901,7 @@ static ESESTATUS phNxpEseProto7816_DecodeFrame(uint8_t* p_data,
       }
     } else /* Error handling 4 */
     {
-      phNxpEse_Sleep(DELAY_ERROR_RECOVERY);
-      if (phNxpEseProto7816_3_Var.recoveryCounter <
-          PH_PROTO_7816_FRAME_RETRY_COUNT) {
+      if (phNxpEseProto7816_RecoveryRetry(PH_PROTO_7816_ERR_UNDEF, true)) {
         phNxpEseProto7816_3_Var.phNxpEseRx_Cntx.lastRcvdRframeInfo.errCode =
             UNDEFINED_ERROR;
         phNxpEseProto7816_3_Var.recoveryCounter++;
@@ -767,6 +919,8 @@ static ESESTATUS phNxpEseProto7816_DecodeFrame(uint8_t* p_data,
     if (frameType != WTX_REQ) {
       StateMachine::GetInstance().ProcessExtEvent(EVT_SPI_RX);
       phNxpEseProto7816_3_Var.wtx_counter = 0;
+      /* A well-formed S-frame shows the link is back */
+      phNxpEseProto7816_RecoveryEnd(true);
     }
     switch (frameType) {
       case RESYNCH_REQ:
@@ -804,6 +958,7 @@ static ESESTATUS phNxpEseProto7816_DecodeFrame(uint8_t* p_data,
         break;
       case WTX_REQ:
         phNxpEseProto7816_3_Var.wtx_counter++;
+        gWtxTotalCount++;
         ALOGD_IF(ese_debug_enabled, "%s Wtx_counter value - %lu", __FUNCTION__,
                  phNxpEseProto7816_3_Var.wtx_counter);
         ALOGD_IF(ese_debug_enabled, "%s Wtx_counter wtx_counter_limit - %lu",
@@ -815,9 +970,9 @@ static ESESTATUS phNxpEseProto7816_DecodeFrame(uint8_t* p_data,
             phNxpEseProto7816_3_Var.phNxpEseLastTx_Cntx.FrameType ==
                 SFRAME) { /* Goto recovery if it keep coming here for more than
                              recovery counter max. value */
-          if (phNxpEseProto7816_3_Var.recoveryCounter <
-              PH_PROTO_7816_FRAME_RETRY_COUNT) { /* Re-transmitting the previous
-                                                    sent S-frame */
+          if (phNxpEseProto7816_RecoveryRetry(
+                  PH_PROTO_7816_ERR_SFRAME,
+                  false)) { /* Re-transmitting the previous sent S-frame */
             phNxpEseProto7816_3_Var.phNxpEseNextTx_Cntx =
                 phNxpEseProto7816_3_Var.phNxpEseLastTx_Cntx;
             phNxpEseProto7816_3_Var.recoveryCounter++;
@@ -917,9 +1072,14 @@ static ESESTATUS phNxpEseProto7816_ProcessResponse(void) {
     if (status == ESESTATUS_SUCCESS) {
       /* Resetting the RNACK retry counter */
       phNxpEseProto7816_3_Var.rnack_retry_counter = PH_PROTO_7816_VALUE_ZERO;
+      /* Receive path errors are over once an intact frame comes in */
+      if ((gRecoveryErr == PH_PROTO_7816_ERR_LRC) ||
+          (gRecoveryErr == PH_PROTO_7816_ERR_TIMEOUT))
+        phNxpEseProto7816_RecoveryEnd(true);
       status = phNxpEseProto7816_DecodeFrame(p_data, data_len);
     } else {
       ALOGE("%s LRC Check failed", __FUNCTION__);
+      phNxpEseProto7816_RecoveryStart(PH_PROTO_7816_ERR_LRC);
       if (phNxpEseProto7816_3_Var.rnack_retry_counter <
           phNxpEseProto7816_3_Var.rnack_retry_limit) {
         phNxpEseProto7816_3_Var.phNxpEseRx_Cntx.lastRcvdFrameType = INVALID;
@@ -942,6 +1102,7 @@ static ESESTATUS phNxpEseProto7816_ProcessResponse(void) {
     }
   } else {
     ALOGE("%s phNxpEseProto7816_GetRawFrame failed", __FUNCTION__);
+    phNxpEseProto7816_RecoveryStart(PH_PROTO_7816_ERR_TIMEOUT);
     if ((SFRAME == phNxpEseProto7816_3_Var.phNxpEseLastTx_Cntx.FrameType) &&
         ((WTX_RSP ==
           phNxpEseProto7816_3_Var.phNxpEseLastTx_Cntx.SframeInfo.sFrameType) ||
@@ -1011,30 +1172,36 @@ static ESESTATUS TransceiveProcess(void) {
     ALOGD_IF(ese_debug_enabled, "%s: CurrentState:%d", __FUNCTION__,
              StateMachine::GetInstance().GetCurrentState());
     if (!StateMachine::GetInstance().isSpiTxRxAllowed()) {
-      if (gMfcAppSessionCount) {
-        ALOGD_IF(ese_debug_enabled,
-                 "%s: Waiting for either 2seconds or RF-OFF...", __FUNCTION__);
-        gSpiTxLock.wait(GUARD_WAIT_TIME_FOR_RF_OFF);
-        if (!StateMachine::GetInstance().isSpiTxRxAllowed()) {
-          phNxpEseProto7816_3_Var.phNxpEseProto7816_CurrentState =
-               PH_NXP_ESE_PROTO_7816_IDLE;
-          return ESESTATUS_WRITE_FAILED;
-        }
-      } else {
-        ALOGD_IF(ese_debug_enabled,
-                 "%s: Waiting for either 10seconds or RF-OFF...", __FUNCTION__);
-        gSpiTxLock.wait(MAX_WAIT_TIME_FOR_RF_OFF);
-        if (!StateMachine::GetInstance().isSpiTxRxAllowed()) {
-          phNxpEseProto7816_3_Var.phNxpEseProto7816_CurrentState =
-               PH_NXP_ESE_PROTO_7816_IDLE;
-          return ESESTATUS_WRITE_FAILED;
-        }
+      /* Never wait past the deadline of the transceive */
+      uint32_t waitTime = phNxpEse_deadlineBound(
+          gMfcAppSessionCount ? GUARD_WAIT_TIME_FOR_RF_OFF
+                              : MAX_WAIT_TIME_FOR_RF_OFF);
+      ALOGD_IF(ese_debug_enabled, "%s: Waiting for either %dms or RF-OFF...",
+               __FUNCTION__, waitTime);
+      uint64_t blockStart = phNxpEse_getTimeMs();
+      if (waitTime > 0) gSpiTxLock.wait(waitTime);
+      phNxpEse_recordRfBlock(phNxpEse_getTimeMs() - blockStart,
+                             StateMachine::GetInstance().isSpiTxRxAllowed());
+      if (!StateMachine::GetInstance().isSpiTxRxAllowed()) {
+        phNxpEseProto7816_3_Var.phNxpEseProto7816_CurrentState =
+            PH_NXP_ESE_PROTO_7816_IDLE;
+        return phNxpEse_deadlineExpired() ? ESESTATUS_RESPONSE_TIMEOUT
+                                          : ESESTATUS_WRITE_FAILED;
       }
     }
   }
 
   while (phNxpEseProto7816_3_Var.phNxpEseProto7816_nextTransceiveState !=
          IDLE_STATE) {
+    if (phNxpEse_deadlineExpired()) {
+      /* Covers WTX chains, retransmissions and recovery alike */
+      ALOGE("%s deadline passed, abandoning the exchange", __FUNCTION__);
+      gResyncPending = true;
+      phNxpEseProto7816_3_Var.phNxpEseProto7816_nextTransceiveState =
+          IDLE_STATE;
+      status = ESESTATUS_RESPONSE_TIMEOUT;
+      break;
+    }
     ALOGD_IF(ese_debug_enabled, "%s nextTransceiveState %x", __FUNCTION__,
              phNxpEseProto7816_3_Var.phNxpEseProto7816_nextTransceiveState);
     StateMachine::GetInstance().ProcessExtEvent(EVT_SPI_TX);
@@ -1045,6 +1212,8 @@ static ESESTATUS TransceiveProcess(void) {
         break;
       case SEND_R_ACK:
         status = phNxpEseProto7816_sendRframe(RACK);
+        /* The acknowledged chunk can be consumed while the next arrives */
+        if (ESESTATUS_SUCCESS == status) phNxpEseProto7816_FlushRspChunk(false);
         break;
       case SEND_R_NACK:
         status = phNxpEseProto7816_sendRframe(RNACK);
@@ -1082,6 +1251,8 @@ static ESESTATUS TransceiveProcess(void) {
           IDLE_STATE;
     }
   };
+  /* The exchange ended while still recovering */
+  phNxpEseProto7816_RecoveryEnd(false);
   ALOGD_IF(ese_debug_enabled, "Exit %s Status 0x%x", __FUNCTION__, status);
   return status;
 }
@@ -1111,6 +1282,9 @@ ESESTATUS phNxpEseProto7816_Transceive(phNxpEse_data* pCmd,
        PH_NXP_ESE_PROTO_7816_IDLE))
     return status;
   phNxpEse_memset(&pRes, 0x00, sizeof(phNxpEse_data));
+  /* Only a session ending right after END OF APDU is warm */
+  gWarmState = false;
+  phNxpEseProto7816_ResyncIfPending();
   /* Updating the transceive information to the protocol stack */
   phNxpEseProto7816_3_Var.phNxpEseProto7816_CurrentState =
       PH_NXP_ESE_PROTO_7816_TRANSCEIVE;
@@ -1121,6 +1295,27 @@ ESESTATUS phNxpEseProto7816_Transceive(phNxpEse_data* pCmd,
            pCmd->len);
   status = phNxpEseProto7816_SetFirstIframeContxt();
   status = TransceiveProcess();
+  if (gWarmUnverified) {
+    gWarmUnverified = false;
+    /* Only a protocol failure points at a stale warm session, a busy or
+     * silent eSE is reported as is */
+    if (ESESTATUS_FAILED == status) {
+      phNxpEseProto7816SecureTimer_t secureTimerParams;
+      ALOGE("%s first exchange after warm open failed, interface reset",
+            __FUNCTION__);
+      if (ESESTATUS_SUCCESS == phNxpEse_GetData(&pRes.len, &pRes.p_data))
+        phNxpEse_free(pRes.p_data);
+      phNxpEse_memset(&pRes, 0x00, sizeof(phNxpEse_data));
+      /* The command is not resent: the eSE may have executed it, the
+       * failure is reported and the caller decides */
+      wStatus = phNxpEseProto7816_IntfReset(&secureTimerParams);
+      if (ESESTATUS_SUCCESS != wStatus) {
+        ALOGE("%s interface reset failed", __FUNCTION__);
+      }
+      phNxpEseProto7816_3_Var.phNxpEseProto7816_CurrentState =
+          PH_NXP_ESE_PROTO_7816_TRANSCEIVE;
+    }
+  }
   if (ESESTATUS_FAILED == status) {
     /* ESE hard reset to be done */
     ALOGE("Transceive failed, hard reset to proceed");
@@ -1136,6 +1331,13 @@ ESESTATUS phNxpEseProto7816_Transceive(phNxpEse_data* pCmd,
     }
   } else if (ESESTATUS_WRITE_FAILED == status) {
     return status;
+  } else if (ESESTATUS_RESPONSE_TIMEOUT == status) {
+    /* Partial data of the abandoned exchange is not reported */
+    if (ESESTATUS_SUCCESS == phNxpEse_GetData(&pRes.len, &pRes.p_data))
+      phNxpEse_free(pRes.p_data);
+  } else if (gRspChunkCb != NULL) {
+    /* Response already streamed, hand over the final chunk */
+    phNxpEseProto7816_FlushRspChunk(true);
   } else {
     // fetch the data info and report to upper layer.
     wStatus = phNxpEse_GetData(&pRes.len, &pRes.p_data);
@@ -1156,6 +1358,38 @@ ESESTATUS phNxpEseProto7816_Transceive(phNxpEse_data* pCmd,
   return status;
 }
 
+/******************************************************************************
+ * Function         phNxpEseProto7816_TransceiveStream
+ *
+ * Description      This function is used like phNxpEseProto7816_Transceive,
+ *                  the response is handed to pCb chunk by chunk instead of
+ *                  being assembled
+ *
+ * Returns          On success return true or else false.
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEseProto7816_TransceiveStream(phNxpEse_data* pCmd,
+                                             phNxpEse_RspChunkCb_t pCb,
+                                             void* pContext) {
+  ESESTATUS status = ESESTATUS_FAILED;
+  phNxpEse_data rsp;
+  if ((NULL == pCb) ||
+      (phNxpEseProto7816_3_Var.phNxpEseProto7816_CurrentState !=
+       PH_NXP_ESE_PROTO_7816_IDLE))
+    return status;
+  phNxpEse_memset(&rsp, 0x00, sizeof(phNxpEse_data));
+  gRspChunkCb = pCb;
+  gRspChunkCtx = pContext;
+  gRspChunkPending = false;
+  status = phNxpEseProto7816_Transceive(pCmd, &rsp);
+  gRspChunkCb = NULL;
+  gRspChunkCtx = NULL;
+  gRspChunkPending = false;
+  /* Partial data kept by the failure path is not part of the stream */
+  if (rsp.p_data != NULL) phNxpEse_free(rsp.p_data);
+  return status;
+}
+
 /******************************************************************************
  * Function         phNxpEseProto7816_RSync
  *
@@ -1224,6 +1458,7 @@ static ESESTATUS phNxpEseProto7816_ResetProtoParams(void) {
   /* This update is helpful in-case a R-NACK is transmitted from the MW */
   phNxpEseProto7816_3_Var.lastSentNonErrorframeType = UNKNOWN;
   phNxpEseProto7816_3_Var.rnack_retry_counter = PH_PROTO_7816_VALUE_ZERO;
+  gResyncPending = false;
   return ESESTATUS_SUCCESS;
 }
 
@@ -1256,12 +1491,38 @@ ESESTATUS phNxpEseProto7816_Reset(void) {
  ******************************************************************************/
 ESESTATUS phNxpEseProto7816_Open(phNxpEseProto7816InitParam_t initParam) {
   ESESTATUS status = ESESTATUS_FAILED;
+  gRecoveryPolicy = initParam.recoveryPolicy;
+  bool warm =
+      gWarmState && (initParam.warmOpen != PH_PROTO_7816_WARM_OPEN_DISABLED);
+  gWarmState = false;
+  gWarmUnverified = false;
+  if (warm && (initParam.warmOpen == PH_PROTO_7816_WARM_OPEN_NONE)) {
+    /* Sequence numbers and IFSC of the previous session stay valid */
+    phNxpEseProto7816_3_Var.wtx_counter_limit = initParam.wtx_counter_limit;
+    phNxpEseProto7816_3_Var.rnack_retry_limit = initParam.rnack_retry_limit;
+    phNxpEseProto7816_3_Var.phNxpEseProto7816_CurrentState =
+        PH_NXP_ESE_PROTO_7816_IDLE;
+    phNxpEseProto7816_ResetRecovery();
+    phNxpEseProto7816_3_Var.timeoutCounter = PH_PROTO_7816_VALUE_ZERO;
+    phNxpEseProto7816_3_Var.rnack_retry_counter = PH_PROTO_7816_VALUE_ZERO;
+    gWarmUnverified = true;
+    ALOGD_IF(ese_debug_enabled, "%s: warm open, no exchange", __FUNCTION__);
+    return ESESTATUS_SUCCESS;
+  }
   status = phNxpEseProto7816_ResetProtoParams();
   ALOGD_IF(ese_debug_enabled, "%s: First open completed, Congratulations",
            __FUNCTION__);
   /* Update WTX max. limit */
   phNxpEseProto7816_3_Var.wtx_counter_limit = initParam.wtx_counter_limit;
   phNxpEseProto7816_3_Var.rnack_retry_limit = initParam.rnack_retry_limit;
+  if (warm && initParam.interfaceReset) {
+    /* Previous session ended cleanly, a R-Sync realigns the sequence
+     * numbers; only fall back to the interface reset if it fails */
+    ALOGD_IF(ese_debug_enabled, "%s: warm open, R-Sync", __FUNCTION__);
+    status = phNxpEseProto7816_RSync();
+    if (ESESTATUS_SUCCESS == status) return status;
+    ALOGE("%s: warm open R-Sync failed, interface reset", __FUNCTION__);
+  }
   if (initParam.interfaceReset) /* Do interface reset */
   {
     status = phNxpEseProto7816_IntfReset(initParam.pSecureTimerParams);
@@ -1315,9 +1576,34 @@ ESESTATUS phNxpEseProto7816_Close(
                   sizeof(phNxpEseProto7816SecureTimer_t));
   phNxpEseProto7816_3_Var.phNxpEseProto7816_CurrentState =
       PH_NXP_ESE_PROTO_7816_IDLE;
+  gWarmState = (ESESTATUS_SUCCESS == status);
+  for (uint8_t err = 0; err < PH_PROTO_7816_ERR_MAX; err++) {
+    if (gRecoveryStats[err].episodes == 0) continue;
+    ALOGD_IF(ese_debug_enabled,
+             "%s error %d: episodes=%u retry=%u/%u intfReset=%u/%u",
+             __FUNCTION__, err, gRecoveryStats[err].episodes,
+             gRecoveryStats[err].recovered[PH_PROTO_7816_TIER_RETRY],
+             gRecoveryStats[err].attempts[PH_PROTO_7816_TIER_RETRY],
+             gRecoveryStats[err].recovered[PH_PROTO_7816_TIER_INTF_RESET],
+             gRecoveryStats[err].attempts[PH_PROTO_7816_TIER_INTF_RESET]);
+  }
   return status;
 }
 
+/******************************************************************************
+ * Function         phNxpEseProto7816_MarkCold
+ *
+ * Description      This function is used to report an eSE reset or power
+ *                  cycle, the next open does a full interface reset
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+void phNxpEseProto7816_MarkCold(void) {
+  gWarmState = false;
+  gWarmUnverified = false;
+}
+
 /******************************************************************************
  * Function         phNxpEseProto7816_IntfReset
  *
@@ -1366,4 +1652,14 @@ ESESTATUS phNxpEseProto7816_SetIfscSize(uint16_t IFSC_Size) {
   phNxpEseProto7816_3_Var.phNxpEseNextTx_Cntx.IframeInfo.maxDataLen = IFSC_Size;
   return ESESTATUS_SUCCESS;
 }
+/******************************************************************************
+ * Function         phNxpEseProto7816_GetWtxCount
+ *
+ * Description      This function is used to get the number of WTX requests
+ *                  received from ESE since the library was loaded
+ *
+ * Returns          Cumulative WTX count
+ *
+ ******************************************************************************/
+uint32_t phNxpEseProto7816_GetWtxCount(void) { return gWtxTotalCount; }
 /** @} */
@@ -252,6 +252,8 @@ typedef struct phNxpEseProto7816 {
 typedef struct phNxpEseProto7816InitParam {
   unsigned long int wtx_counter_limit; /*!< WTX count limit */
   bool interfaceReset;                 /*!< INTF reset required or not>*/
+  uint8_t warmOpen; /*!< PH_PROTO_7816_WARM_OPEN_* used after a clean close>*/
+  uint8_t recoveryPolicy; /*!< PH_PROTO_7816_RECOVERY_* >*/
   unsigned long int rnack_retry_limit;
   phNxpEseProto7816SecureTimer_t*
       pSecureTimerParams; /*!< Secure timer value updated here >*/
@@ -284,6 +286,65 @@ static phNxpEseProto7816_t phNxpEseProto7816_3_Var;
  * \brief Max. size of the frame that can be sent
  */
 #define IFSC_SIZE_SEND 254
+/*!
+ * \brief Open modes used when the previous session was closed cleanly
+ */
+#define PH_PROTO_7816_WARM_OPEN_DISABLED 0x00
+#define PH_PROTO_7816_WARM_OPEN_RSYNC 0x01
+#define PH_PROTO_7816_WARM_OPEN_NONE 0x02
+
+/*!
+ * \brief Error recovery policies: always walk through all the tiers, or skip
+ * the retry tier for error types it does not recover
+ */
+#define PH_PROTO_7816_RECOVERY_FIXED 0x00
+#define PH_PROTO_7816_RECOVERY_ADAPTIVE 0x01
+
+/*!
+ * \brief Adaptive recovery: retries are skipped for an error type once at
+ * least PH_PROTO_7816_RECOVERY_MIN_SAMPLES retry episodes were seen and less
+ * than PH_PROTO_7816_RECOVERY_MIN_SUCCESS percent of them recovered. Every
+ * PH_PROTO_7816_RECOVERY_PROBE_INTERVAL-th episode still retries so that the
+ * statistics follow changes of the link.
+ */
+#define PH_PROTO_7816_RECOVERY_MIN_SAMPLES 8
+#define PH_PROTO_7816_RECOVERY_MIN_SUCCESS 10
+#define PH_PROTO_7816_RECOVERY_PROBE_INTERVAL 16
+
+/*!
+ * \brief Recovery tiers, in escalation order
+ */
+#define PH_PROTO_7816_TIER_RETRY 0x00
+#define PH_PROTO_7816_TIER_INTF_RESET 0x01
+#define PH_PROTO_7816_TIER_MAX 0x02
+
+/*!
+ * \brief Error types tracked by the recovery statistics
+ */
+typedef enum phNxpEseProto7816_ErrType {
+  PH_PROTO_7816_ERR_SEQ = 0, /*!< I-frame with unexpected sequence number */
+  PH_PROTO_7816_ERR_RNACK,   /*!< R-NACK: parity or other error at eSE */
+  PH_PROTO_7816_ERR_SOF,     /*!< R-frame: SOF missed at eSE */
+  PH_PROTO_7816_ERR_UNDEF,   /*!< R-frame: undefined error */
+  PH_PROTO_7816_ERR_SFRAME,  /*!< S-frame answered by a WTX request */
+  PH_PROTO_7816_ERR_LRC,     /*!< LRC mismatch on a received frame */
+  PH_PROTO_7816_ERR_TIMEOUT, /*!< no frame received from eSE */
+  PH_PROTO_7816_ERR_MAX
+} phNxpEseProto7816_ErrType_t;
+
+/*!
+ * \brief Recovery outcome of one error type
+ */
+typedef struct phNxpEseProto7816_RecoveryStats {
+  uint32_t episodes; /*!< error episodes started with this error type */
+  uint32_t attempts[PH_PROTO_7816_TIER_MAX];  /*!< episodes reaching a tier */
+  uint32_t recovered[PH_PROTO_7816_TIER_MAX]; /*!< episodes ended at a tier */
+} phNxpEseProto7816_RecoveryStats_t;
+
+/*!
+ * \brief Max. information field length of a received frame
+ */
+#define PH_PROTO_7816_MAX_INF_LEN 0xFF
 /*!
  * \brief Delay to be used before sending the next frame, after error reported
  * by ESE
@@ -404,6 +465,14 @@ ESESTATUS phNxpEseProto7816_IntfReset(
 ESESTATUS phNxpEseProto7816_Close(
     phNxpEseProto7816SecureTimer_t* secureTimerParams);
 
+/**
+ * \ingroup ISO7816-3_protocol_lib
+ * \brief This function is used to report that the eSE was reset or power
+ *        cycled, so the next open must not rely on the previous session
+ *
+ */
+void phNxpEseProto7816_MarkCold(void);
+
 /**
  * \ingroup ISO7816-3_protocol_lib
  * \brief This function is used to open the 7816 protocol stack instance
@@ -433,6 +502,23 @@ ESESTATUS phNxpEseProto7816_Open(phNxpEseProto7816InitParam_t initParam);
 ESESTATUS phNxpEseProto7816_Transceive(phNxpEse_data* pCmd,
                                        phNxpEse_data* pRsp);
 
+/**
+ * \ingroup ISO7816-3_protocol_lib
+ * \brief This function is used like phNxpEseProto7816_Transceive, but each
+ *        received I-frame is handed to pCb after its R-ACK is sent instead
+ *        of being stored for assembly
+ *
+ * \param[in]       phNxpEse_data: Command to ESE
+ * \param[in]       phNxpEse_RspChunkCb_t: response sink
+ * \param[in]       void*: sink context
+ *
+ * \retval On success return true or else false.
+ *
+ */
+ESESTATUS phNxpEseProto7816_TransceiveStream(phNxpEse_data* pCmd,
+                                             phNxpEse_RspChunkCb_t pCb,
+                                             void* pContext);
+
 /**
  * \ingroup ISO7816-3_protocol_lib
  * \brief This function is used to reset the 7816 protocol stack instance
@@ -453,5 +539,15 @@ ESESTATUS phNxpEseProto7816_Reset(void);
  */
 ESESTATUS phNxpEseProto7816_SetIfscSize(uint16_t IFSC_Size);
 
+/**
+ * \ingroup ISO7816-3_protocol_lib
+ * \brief This function is used to get the number of WTX requests received
+ *        since the library was loaded
+ *
+ * \retval Cumulative WTX count
+ *
+ */
+uint32_t phNxpEseProto7816_GetWtxCount(void);
+
 /** @} */
 #endif /* _PHNXPESEPROTO7816_3_H_ */
@@ -27,6 +27,8 @@
 #include <phNxpEsePal_spi.h>
 #include <phNxpEseProto7816_3.h>
 #include <phNxpEse_Internal.h>
+#include <atomic>
+#include <deque>
 
 #define RECIEVE_PACKET_SOF 0xA5
 #define PH_PAL_ESE_PRINT_PACKET_TX(data, len) \
@@ -35,6 +37,17 @@
   ({ phPalEse_print_packet("RECV", data, len); })
 static int phNxpEse_readPacket(void* pDevHandle, uint8_t* pBuffer,
                                int nNbBytesToRead);
+static ESESTATUS phNxpEse_doTransceive(phNxpEse_data* pCmd,
+                                       phNxpEse_data* pRsp,
+                                       const phNxpEse_TransceiveOpts_t* pOpts);
+static ESESTATUS phNxpEse_fgTransceive(phNxpEse_data* pCmd,
+                                       phNxpEse_data* pRsp,
+                                       const phNxpEse_TransceiveOpts_t* pOpts);
+static ESESTATUS phNxpEse_bgTransceive(phNxpEse_data* pCmd,
+                                       phNxpEse_data* pRsp,
+                                       const phNxpEse_TransceiveOpts_t* pOpts);
+static bool phNxpEse_isChannelAllowed(const phNxpEse_data* pCmd,
+                                      uint32_t owner);
 #ifdef NXP_ESE_JCOP_DWNLD_PROTECTION
 static ESESTATUS phNxpEse_checkJcopDwnldState(void);
 static ESESTATUS phNxpEse_setJcopDwnldState(phNxpEse_JcopDwnldState state);
@@ -42,18 +55,68 @@ static ESESTATUS phNxpEse_setJcopDwnldState(phNxpEse_JcopDwnldState state);
 #ifdef NXP_NFCC_SPI_FW_DOWNLOAD_SYNC
 static ESESTATUS phNxpEse_checkFWDwnldStatus(void);
 #endif
+static bool phNxpEse_isCardContentCmd(uint8_t ins);
+static bool phNxpEse_leaseBlocks(void);
+static bool phNxpEse_waitLease(uint64_t deadline);
 extern void phNxpEse_secureTimerStop();
 void phNxpEse_GetMaxTimer(unsigned long *pMaxTimer);
 #ifdef NXP_SECURE_TIMER_SESSION
 static unsigned char* phNxpEse_GgetTimerTlvBuffer(unsigned char* timer_buffer,
                                                   unsigned int value);
 #endif
+static void phNxpEse_pwrWindowSetReady(bool ready);
+static ESESTATUS phNxpEse_rfQueueEnter(uint64_t deadline, uint64_t* pTicket);
+static void phNxpEse_rfQueueExit(uint64_t ticket);
+static void phNxpEse_recordWait(uint32_t* pHist, uint64_t waitMs);
 /*********************** Global Variables *************************************/
 
 /* ESE Context structure */
 phNxpEse_Context_t nxpese_ctxt;
 bool ese_debug_enabled = true;
 SyncEvent gSpiOpenLock;
+/* Foreground/background transceive arbitration */
+static SyncEvent gTransceiveGate;
+static uint32_t gFgPendingCount = 0;
+static uint32_t gFgActiveCount = 0;
+static bool gBgApduInFlight = false;
+static uint32_t gBgDutyCycle = ESE_BG_DUTY_CYCLE_DEFAULT;
+static uint32_t gBgMaxYieldTime = ESE_BG_MAX_YIELD_TIME;
+static phNxpEse_ArbStats_t gArbStats;
+/* Automatic 61xx/6Cxx handling, channel bitmasks from config and ioctl */
+static uint32_t gAutoRespConfigMask = 0;
+static uint32_t gAutoRespRuntimeMask = 0;
+static uint32_t gAutoRespMaxLen = ESE_AUTO_GET_RESP_MAX_LEN;
+/* Client holding each channel through SecureElement, 0 if none. Held
+ * across checked exchanges so that owners cannot change during them. */
+static SyncEvent gChannelOwnerLock;
+static uint32_t gChannelOwner[ESE_MAX_LOGICAL_CHANNELS];
+/* Exclusive lease, gLeaseId 0 means no lease */
+static uint64_t gLeaseId = 0;
+static uint64_t gLeaseSeq = 0;
+static uint64_t gLeaseDeadline = 0;
+static bool gLeaseApduInFlight = false;
+/* Priority lease, the lease it preempted resumes when it ends */
+static bool gLeaseIsPrio = false;
+static uint32_t gPrioPendingCount = 0;
+static uint64_t gPausedLeaseId = 0;
+static uint64_t gPausedLeaseRemaining = 0;
+static uint32_t gPrioMaxWaitTime = ESE_PRIO_MAX_WAIT_TIME;
+/* Deadline of the transceive in progress, 0 if none */
+static uint64_t gTransceiveDeadline = 0;
+/* Bumped whenever the applet set or selection state of the eSE may change */
+static std::atomic<uint32_t> gContentGeneration(0);
+/* Transceives submitted while SPI is suspended for RF, in submission order.
+ * Guarded by gSpiTxLock. */
+extern SyncEvent gSpiTxLock;
+static std::deque<uint64_t> gRfQueue;
+static uint64_t gRfQueueSeq = 0;
+/* Power windows shared by deferrable requests */
+static SyncEvent gPwrWindowEvent;
+static bool gPwrWindowReady = false;     /* session open and initialized */
+static bool gPwrWindowOwned = false;     /* session owned by the scheduler */
+static bool gPwrWindowTransit = false;   /* scheduler opening/closing */
+static uint32_t gPwrWindowHolders = 0;   /* deferrable requests inside */
+static phNxpEse_PwrWindowStats_t gPwrWindowStats;
 
 /******************************************************************************
  * Function         phNxpLog_InitializeLogLevel
@@ -96,6 +159,7 @@ ESESTATUS phNxpEse_init(phNxpEse_initParams initParams) {
   ESESTATUS wConfigStatus = ESESTATUS_FAILED;
   unsigned long int num;
   unsigned long maxTimer = 0;
+  uint64_t openTime = 0;
   phNxpEseProto7816InitParam_t protoInitParam;
   phNxpEse_memset(&protoInitParam, 0x00, sizeof(phNxpEseProto7816InitParam_t));
   /* STATUS_OPEN */
@@ -115,6 +179,8 @@ ESESTATUS phNxpEse_init(phNxpEse_initParams initParams) {
   } else {
     protoInitParam.rnack_retry_limit = MAX_RNACK_RETRY_LIMIT;
   }
+  protoInitParam.recoveryPolicy = EseConfig::getUnsigned(
+      NAME_NXP_RECOVERY_POLICY, PH_PROTO_7816_RECOVERY_FIXED);
   if (ESE_MODE_NORMAL ==
       initParams.initMode) /* TZ/Normal wired mode should come here*/
   {
@@ -125,10 +191,28 @@ ESESTATUS phNxpEse_init(phNxpEse_initParams initParams) {
     } else {
       protoInitParam.interfaceReset = true;
     }
+    protoInitParam.warmOpen = EseConfig::getUnsigned(
+        NAME_NXP_SPI_WARM_OPEN, PH_PROTO_7816_WARM_OPEN_DISABLED);
   } else /* OSU mode, no interface reset is required */
   {
     protoInitParam.interfaceReset = false;
+    protoInitParam.warmOpen = PH_PROTO_7816_WARM_OPEN_DISABLED;
   }
+  gBgDutyCycle =
+      EseConfig::getUnsigned(NAME_NXP_LS_DUTY_CYCLE, ESE_BG_DUTY_CYCLE_DEFAULT);
+  if ((gBgDutyCycle == 0) || (gBgDutyCycle > 100)) {
+    gBgDutyCycle = ESE_BG_DUTY_CYCLE_DEFAULT;
+  }
+  gBgMaxYieldTime =
+      EseConfig::getUnsigned(NAME_NXP_LS_MAX_YIELD_TIME, ESE_BG_MAX_YIELD_TIME);
+  /* Background never yields longer than foreground waits for it */
+  if (gBgMaxYieldTime > ESE_FG_MAX_WAIT_TIME)
+    gBgMaxYieldTime = ESE_FG_MAX_WAIT_TIME;
+  gPrioMaxWaitTime = EseConfig::getUnsigned(NAME_NXP_PRIO_MAX_WAIT_TIME,
+                                            ESE_PRIO_MAX_WAIT_TIME);
+  gAutoRespConfigMask = EseConfig::getUnsigned(NAME_NXP_AUTO_GET_RESPONSE, 0);
+  gAutoRespMaxLen = EseConfig::getUnsigned(NAME_NXP_AUTO_GET_RESPONSE_MAX_LEN,
+                                           ESE_AUTO_GET_RESP_MAX_LEN);
   /* Sharing lib context for fetching secure timer values */
   protoInitParam.pSecureTimerParams =
       (phNxpEseProto7816SecureTimer_t*)&nxpese_ctxt.secureTimerParams;
@@ -142,10 +226,15 @@ ESESTATUS phNxpEse_init(phNxpEse_initParams initParams) {
   phNxpEse_GetMaxTimer(&maxTimer);
 
   /* T=1 Protocol layer open */
+  openTime = phNxpEse_getTimeMs();
   wConfigStatus = phNxpEseProto7816_Open(protoInitParam);
+  ALOGD_IF(ese_debug_enabled, "%s T=1 open took %llu ms", __FUNCTION__,
+           (unsigned long long)(phNxpEse_getTimeMs() - openTime));
   if (ESESTATUS_FAILED == wConfigStatus) {
     wConfigStatus = ESESTATUS_FAILED;
     ALOGE("phNxpEseProto7816_Open failed");
+  } else {
+    phNxpEse_pwrWindowSetReady(true);
   }
   return wConfigStatus;
 }
@@ -574,7 +663,7 @@ static ESESTATUS phNxpEse_checkJcopDwnldState(void) {
   ALOGE("phNxpEse_checkJcopDwnld Enter");
   ESESTATUS wSpmStatus = ESESTATUS_SUCCESS;
   spm_state_t current_spm_state = SPM_STATE_INVALID;
-  uint8_t ese_dwnld_retry = 0x00;
+  uint64_t deadline = phNxpEse_getTimeMs() + ESE_JCOP_DWNLD_MAX_WAIT;
   ESESTATUS status = ESESTATUS_FAILED;
 
   wSpmStatus = phNxpEse_SPM_GetState(&current_spm_state);
@@ -586,8 +675,8 @@ static ESESTATUS phNxpEse_checkJcopDwnldState(void) {
 
     status = phNxpEse_setJcopDwnldState(JCP_DWNLD_INIT);
     if (status == ESESTATUS_SUCCESS) {
-      while (ese_dwnld_retry < ESE_JCOP_OS_DWNLD_RETRY_CNT) {
-        ALOGE("ESE_JCOP_OS_DWNLD_RETRY_CNT retry count");
+      for (;;) {
+        uint32_t dwnldStateSeq = phPalEse_spi_getDwnldStateSeq();
         wSpmStatus = phNxpEse_SPM_GetState(&current_spm_state);
         if (wSpmStatus == ESESTATUS_SUCCESS) {
           if ((current_spm_state & SPM_STATE_JCOP_DWNLD)) {
@@ -598,9 +687,15 @@ static ESESTATUS phNxpEse_checkJcopDwnldState(void) {
           status = ESESTATUS_FAILED;
           break;
         }
-        phNxpEse_Sleep(
-            200000); /*sleep for 200 ms checking for jcop dwnld status*/
-        ese_dwnld_retry++;
+        /*Re-check as soon as NFC HAL reports a state change, else every
+         * ESE_JCOP_DWNLD_POLL_TIME ms, until the deadline set at entry*/
+        uint64_t now = phNxpEse_getTimeMs();
+        if (now >= deadline) break;
+        phPalEse_spi_waitDwnldState(
+            dwnldStateSeq, ((deadline - now) < ESE_JCOP_DWNLD_POLL_TIME)
+                               ? (deadline - now)
+                               : ESE_JCOP_DWNLD_POLL_TIME);
+        phNxpEse_SPM_InvalidateState();
       }
     }
   }
@@ -610,35 +705,103 @@ static ESESTATUS phNxpEse_checkJcopDwnldState(void) {
 }
 #endif
 /******************************************************************************
- * Function         phNxpEse_Transceive
+ * Function         phNxpEse_isCardContentCmd
+ *
+ * Description      This function checks if INS is a GlobalPlatform card
+ *                  content management command (LOAD, INSTALL, DELETE,
+ *                  SET STATUS)
  *
- * Description      This function update the len and provided buffer
+ * Returns          true if the command may change the applet set
+ *
+ ******************************************************************************/
+static bool phNxpEse_isCardContentCmd(uint8_t ins) {
+  return (ins == 0xE8) || (ins == 0xE6) || (ins == 0xE4) || (ins == 0xF0);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_InvalidateContent
+ *
+ * Description      This function marks all cached knowledge about the eSE
+ *                  applets (e.g. SELECT results) as stale
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+void phNxpEse_InvalidateContent(void) { gContentGeneration++; }
+
+/******************************************************************************
+ * Function         phNxpEse_GetContentGeneration
+ *
+ * Description      This function returns the eSE content generation, it
+ *                  changes on card content management APDUs, resets and
+ *                  phNxpEse_InvalidateContent
+ *
+ * Returns          Content generation
+ *
+ ******************************************************************************/
+uint32_t phNxpEse_GetContentGeneration(void) { return gContentGeneration; }
+
+/******************************************************************************
+ * Function         phNxpEse_doTransceive
+ *
+ * Description      This function update the len and provided buffer, or
+ *                  streams the response through pOpts when set
  *
  * Returns          On Success ESESTATUS_SUCCESS else proper error code
  *
  ******************************************************************************/
-ESESTATUS phNxpEse_Transceive(phNxpEse_data* pCmd, phNxpEse_data* pRsp) {
+static ESESTATUS phNxpEse_doTransceive(phNxpEse_data* pCmd,
+                                       phNxpEse_data* pRsp,
+                                       const phNxpEse_TransceiveOpts_t* pOpts) {
   ESESTATUS status = ESESTATUS_FAILED;
+  bool rspStream = (NULL != pOpts) && (NULL != pOpts->pRspCb);
 
-  if ((NULL == pCmd) || (NULL == pRsp)) return ESESTATUS_INVALID_PARAMETER;
+  if ((NULL == pCmd) || ((NULL == pRsp) && !rspStream))
+    return ESESTATUS_INVALID_PARAMETER;
 
-  if ((pCmd->len == 0) || pCmd->p_data == NULL) {
+  if ((pCmd->len == 0) || (pCmd->p_data == NULL)) {
     ALOGE(" phNxpEse_Transceive - Invalid Parameter no data\n");
     return ESESTATUS_INVALID_PARAMETER;
   } else if ((ESE_STATUS_CLOSE == nxpese_ctxt.EseLibStatus)) {
     ALOGE(" %s ESE Not Initialized \n", __FUNCTION__);
     return ESESTATUS_NOT_INITIALISED;
+  }
+  uint64_t rfTicket = 0;
+  status = phNxpEse_rfQueueEnter((NULL != pOpts) ? pOpts->deadline : 0,
+                                 &rfTicket);
+  if (ESESTATUS_SUCCESS != status) {
+    return status;
   } else if ((ESE_STATUS_BUSY == nxpese_ctxt.EseLibStatus)) {
     ALOGE(" %s ESE - BUSY \n", __FUNCTION__);
+    phNxpEse_rfQueueExit(rfTicket);
     return ESESTATUS_BUSY;
   } else {
     nxpese_ctxt.EseLibStatus = ESE_STATUS_BUSY;
-    status = phNxpEseProto7816_Transceive((phNxpEse_data*)pCmd,
-                                          (phNxpEse_data*)pRsp);
+    gTransceiveDeadline = (NULL != pOpts) ? pOpts->deadline : 0;
+    /* Owners are checked and cannot change until the exchange is over */
+    SyncEventGuard ownerGuard(gChannelOwnerLock);
+    bool allowed = (NULL == pOpts) || (pOpts->owner == 0) ||
+                   phNxpEse_isChannelAllowed(pCmd, pOpts->owner);
+    if (allowed && (pCmd->len >= 2) &&
+        phNxpEse_isCardContentCmd(pCmd->p_data[1])) {
+      phNxpEse_InvalidateContent();
+    }
+    if (!allowed) {
+      ALOGE(" %s channel not held by the caller \n", __FUNCTION__);
+      status = ESESTATUS_NOT_ALLOWED;
+    } else if (rspStream) {
+      status = phNxpEseProto7816_TransceiveStream(pCmd, pOpts->pRspCb,
+                                                  pOpts->pContext);
+    } else {
+      status = phNxpEseProto7816_Transceive((phNxpEse_data*)pCmd,
+                                            (phNxpEse_data*)pRsp);
+    }
     if (ESESTATUS_SUCCESS != status) {
       ALOGE(" %s phNxpEseProto7816_Transceive- Failed \n", __FUNCTION__);
     }
+    gTransceiveDeadline = 0;
     nxpese_ctxt.EseLibStatus = ESE_STATUS_IDLE;
+    phNxpEse_rfQueueExit(rfTicket);
 
     ALOGD_IF(ese_debug_enabled, " %s Exit status 0x%x \n", __FUNCTION__,
              status);
@@ -646,6 +809,987 @@ ESESTATUS phNxpEse_Transceive(phNxpEse_data* pCmd, phNxpEse_data* pRsp) {
   }
 }
 
+/******************************************************************************
+ * Function         phNxpEse_rfQueueEnter
+ *
+ * Description      This function queues a transceive submitted while SPI is
+ *                  suspended for RF, or while earlier ones are still queued.
+ *                  Once SPI is allowed again the queue drains in submission
+ *                  order, each transceive handing over to the next as soon
+ *                  as it completed. A queued transceive gives up at its
+ *                  deadline, or by default after the RF off wait time.
+ *
+ * Returns          ESESTATUS_SUCCESS when the transceive may proceed, then
+ *                  *pTicket is passed to phNxpEse_rfQueueExit
+ *
+ ******************************************************************************/
+static ESESTATUS phNxpEse_rfQueueEnter(uint64_t deadline, uint64_t* pTicket) {
+  phNxpEse_SpiAvailability_t avail = ESE_SPI_AVAILABLE;
+  uint64_t startTime = phNxpEse_getTimeMs();
+  uint64_t now = startTime;
+  bool allowed = false;
+  bool callerDeadline = (deadline != 0);
+  uint64_t ticket = 0;
+  *pTicket = 0;
+  {
+    SyncEventGuard guard(gSpiTxLock);
+    if (gRfQueue.empty() && StateMachine::GetInstance().isSpiTxRxAllowed())
+      return ESESTATUS_SUCCESS;
+    ticket = ++gRfQueueSeq;
+    gRfQueue.push_back(ticket);
+    if (!callerDeadline) {
+      phNxpEse_GetSpiAvailability(&avail, NULL);
+      deadline = startTime + ((avail == ESE_SPI_RF_BUSY_FELICA)
+                                  ? GUARD_WAIT_TIME_FOR_RF_OFF
+                                  : MAX_WAIT_TIME_FOR_RF_OFF);
+    }
+    ALOGD_IF(ese_debug_enabled, "%s: ticket %llu queued behind %zu",
+             __FUNCTION__, (unsigned long long)ticket, gRfQueue.size() - 1);
+    for (;;) {
+      allowed = (gRfQueue.front() == ticket) &&
+                StateMachine::GetInstance().isSpiTxRxAllowed();
+      if (allowed || (now >= deadline)) break;
+      gSpiTxLock.wait(deadline - now);
+      now = phNxpEse_getTimeMs();
+    }
+    if (!allowed) {
+      for (auto it = gRfQueue.begin(); it != gRfQueue.end(); ++it) {
+        if (*it == ticket) {
+          gRfQueue.erase(it);
+          break;
+        }
+      }
+      /* The head may have changed */
+      gSpiTxLock.notifyAll();
+    }
+  }
+  phNxpEse_recordRfBlock(now - startTime, allowed);
+  if (!allowed) {
+    ALOGE("%s: ticket %llu expired after %llu ms", __FUNCTION__,
+          (unsigned long long)ticket, (unsigned long long)(now - startTime));
+    return callerDeadline ? ESESTATUS_RESPONSE_TIMEOUT : ESESTATUS_WRITE_FAILED;
+  }
+  *pTicket = ticket;
+  return ESESTATUS_SUCCESS;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_rfQueueExit
+ *
+ * Description      This function lets the next queued transceive proceed
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+static void phNxpEse_rfQueueExit(uint64_t ticket) {
+  if (ticket == 0) return;
+  SyncEventGuard guard(gSpiTxLock);
+  if (!gRfQueue.empty() && (gRfQueue.front() == ticket)) gRfQueue.pop_front();
+  gSpiTxLock.notifyAll();
+}
+
+/******************************************************************************
+ * Function         phNxpEse_deadlineExpired
+ *
+ * Description      This function checks the deadline of the transceive in
+ *                  progress
+ *
+ * Returns          true if a deadline is set and has passed
+ *
+ ******************************************************************************/
+bool phNxpEse_deadlineExpired(void) {
+  return (gTransceiveDeadline != 0) &&
+         (phNxpEse_getTimeMs() >= gTransceiveDeadline);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_deadlineBound
+ *
+ * Description      This function shortens a wait so that it does not outlast
+ *                  the deadline of the transceive in progress
+ *
+ * Returns          waitMs, or the time left before the deadline if shorter
+ *
+ ******************************************************************************/
+uint32_t phNxpEse_deadlineBound(uint32_t waitMs) {
+  if (gTransceiveDeadline == 0) return waitMs;
+  uint64_t now = phNxpEse_getTimeMs();
+  if (now >= gTransceiveDeadline) return 0;
+  if ((gTransceiveDeadline - now) < waitMs)
+    return (uint32_t)(gTransceiveDeadline - now);
+  return waitMs;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_getTimeMs
+ *
+ * Description      This function returns the monotonic clock in milliseconds
+ *
+ * Returns          Current time in ms
+ *
+ ******************************************************************************/
+uint64_t phNxpEse_getTimeMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_Transceive
+ *
+ * Description      This function is used by foreground (OMAPI) clients. If a
+ *                  background APDU is in flight it waits for that APDU to
+ *                  complete instead of failing with ESESTATUS_BUSY; pending
+ *                  foreground requests make background clients yield at the
+ *                  next APDU boundary.
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_Transceive(phNxpEse_data* pCmd, phNxpEse_data* pRsp) {
+  return phNxpEse_fgTransceive(pCmd, pRsp, NULL);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_ClientTransceive
+ *
+ * Description      This function is used like phNxpEse_Transceive by
+ *                  extension clients, on behalf of owner. The channel of the
+ *                  APDU is checked against the channel owners as part of the
+ *                  exchange, owners do not change until it completes.
+ *
+ * Returns          ESESTATUS_NOT_ALLOWED if owner may not use the channel,
+ *                  else as phNxpEse_Transceive
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_ClientTransceive(uint32_t owner, phNxpEse_data* pCmd,
+                                    phNxpEse_data* pRsp) {
+  phNxpEse_TransceiveOpts_t opts = {NULL, NULL, 0, owner};
+  return phNxpEse_fgTransceive(pCmd, pRsp, &opts);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_TransceiveStream
+ *
+ * Description      This function is used by foreground clients that consume
+ *                  the response as it arrives. Arbitration is the same as
+ *                  phNxpEse_Transceive, each chained I-frame is handed to pCb
+ *                  once acknowledged. If owner is not 0 the channel is
+ *                  checked as by phNxpEse_ClientTransceive.
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_TransceiveStream(uint32_t owner, phNxpEse_data* pCmd,
+                                    phNxpEse_RspChunkCb_t pCb,
+                                    void* pContext) {
+  phNxpEse_TransceiveOpts_t opts = {pCb, pContext, 0, owner};
+  if (NULL == pCb) return ESESTATUS_INVALID_PARAMETER;
+  return phNxpEse_fgTransceive(pCmd, NULL, &opts);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_fgTransceive
+ *
+ * Description      This function arbitrates a foreground APDU against
+ *                  background clients and leases
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+static ESESTATUS phNxpEse_fgTransceive(phNxpEse_data* pCmd,
+                                       phNxpEse_data* pRsp,
+                                       const phNxpEse_TransceiveOpts_t* pOpts) {
+  ESESTATUS status = ESESTATUS_FAILED;
+  uint64_t deadline = (NULL != pOpts) ? pOpts->deadline : 0;
+  bool expired = false;
+  {
+    SyncEventGuard guard(gTransceiveGate);
+    /* Counted while waiting for a lease too, new leases wait for it */
+    gFgPendingCount++;
+    expired = !phNxpEse_waitLease(deadline);
+    if (!expired && gBgApduInFlight) {
+      uint64_t startTime = phNxpEse_getTimeMs();
+      uint64_t elapsed = 0;
+      uint64_t maxWait = ESE_FG_MAX_WAIT_TIME;
+      if (deadline != 0)
+        maxWait = (deadline > startTime) ? (deadline - startTime) : 0;
+      if (maxWait > ESE_FG_MAX_WAIT_TIME) maxWait = ESE_FG_MAX_WAIT_TIME;
+      while (gBgApduInFlight && (elapsed < maxWait)) {
+        gTransceiveGate.wait(maxWait - elapsed);
+        elapsed = phNxpEse_getTimeMs() - startTime;
+      }
+      expired = gBgApduInFlight && (maxWait < ESE_FG_MAX_WAIT_TIME);
+      gArbStats.fgWaitCount++;
+      gArbStats.fgWaitTimeMs += elapsed;
+      if (elapsed > gArbStats.fgWaitMaxMs) gArbStats.fgWaitMaxMs = elapsed;
+      phNxpEse_recordWait(gArbStats.fgWaitHist, elapsed);
+      ALOGD_IF(ese_debug_enabled, "%s waited %llu ms for background APDU",
+               __FUNCTION__, (unsigned long long)elapsed);
+    }
+    /* A lease may have been granted while waiting for the background */
+    if (!expired) expired = !phNxpEse_waitLease(deadline);
+    gFgActiveCount++;
+  }
+
+  if (expired) {
+    ALOGE("%s deadline passed before the eSE was available", __FUNCTION__);
+    status = ESESTATUS_RESPONSE_TIMEOUT;
+  } else {
+    status = phNxpEse_doTransceive(pCmd, pRsp, pOpts);
+  }
+
+  {
+    SyncEventGuard guard(gTransceiveGate);
+    gFgActiveCount--;
+    gFgPendingCount--;
+    gArbStats.fgApduCount++;
+    /* Re-evaluate background clients held at an APDU boundary */
+    gTransceiveGate.notifyAll();
+  }
+  return status;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_BgTransceive
+ *
+ * Description      This function is used by background clients (Loader
+ *                  Service). At every APDU boundary it yields to pending
+ *                  foreground requests for at most NXP_LS_MAX_YIELD_TIME and,
+ *                  when NXP_LS_DUTY_CYCLE is below 100, idles in proportion
+ *                  to the time spent on the eSE.
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_BgTransceive(phNxpEse_data* pCmd, phNxpEse_data* pRsp) {
+  return phNxpEse_bgTransceive(pCmd, pRsp, NULL);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_BgClientTransceive
+ *
+ * Description      This function is used like phNxpEse_BgTransceive by
+ *                  extension clients, on behalf of owner. The channel is
+ *                  checked as by phNxpEse_ClientTransceive.
+ *
+ * Returns          ESESTATUS_NOT_ALLOWED if owner may not use the channel,
+ *                  else as phNxpEse_BgTransceive
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_BgClientTransceive(uint32_t owner, phNxpEse_data* pCmd,
+                                      phNxpEse_data* pRsp) {
+  phNxpEse_TransceiveOpts_t opts = {NULL, NULL, 0, owner};
+  return phNxpEse_bgTransceive(pCmd, pRsp, &opts);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_bgTransceive
+ *
+ * Description      This function arbitrates a background APDU against
+ *                  foreground clients and leases
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+static ESESTATUS phNxpEse_bgTransceive(phNxpEse_data* pCmd,
+                                       phNxpEse_data* pRsp,
+                                       const phNxpEse_TransceiveOpts_t* pOpts) {
+  ESESTATUS status = ESESTATUS_FAILED;
+  uint64_t startTime = 0;
+  uint64_t elapsed = 0;
+  {
+    SyncEventGuard guard(gTransceiveGate);
+    if (gFgPendingCount > 0) {
+      startTime = phNxpEse_getTimeMs();
+      /* Never overlap an in-flight foreground APDU; queued ones are
+       * served for at most gBgMaxYieldTime */
+      while (((gFgActiveCount > 0) && (elapsed < ESE_FG_MAX_WAIT_TIME)) ||
+             ((gFgPendingCount > 0) && (elapsed < gBgMaxYieldTime))) {
+        uint64_t bound =
+            (gFgActiveCount > 0) ? ESE_FG_MAX_WAIT_TIME : gBgMaxYieldTime;
+        /* elapsed may already be past the bound after a mode switch */
+        gTransceiveGate.wait((bound > elapsed) ? (bound - elapsed) : 0);
+        elapsed = phNxpEse_getTimeMs() - startTime;
+      }
+      gArbStats.bgYieldCount++;
+      gArbStats.bgYieldTimeMs += elapsed;
+      phNxpEse_recordWait(gArbStats.bgYieldHist, elapsed);
+    }
+    phNxpEse_waitLease(0);
+    gBgApduInFlight = true;
+  }
+
+  startTime = phNxpEse_getTimeMs();
+  status = phNxpEse_doTransceive(pCmd, pRsp, pOpts);
+  elapsed = phNxpEse_getTimeMs() - startTime;
+
+  {
+    SyncEventGuard guard(gTransceiveGate);
+    gBgApduInFlight = false;
+    gArbStats.bgApduCount++;
+    gTransceiveGate.notifyAll();
+    if ((gBgDutyCycle < 100) && (gFgPendingCount == 0)) {
+      /* Idle long enough to keep background usage at gBgDutyCycle percent,
+       * the gate is free for foreground requests meanwhile */
+      uint64_t idleTime = (elapsed * (100 - gBgDutyCycle)) / gBgDutyCycle;
+      if (idleTime > gBgMaxYieldTime) idleTime = gBgMaxYieldTime;
+      if (idleTime > 0) {
+        startTime = phNxpEse_getTimeMs();
+        gTransceiveGate.wait(idleTime);
+        gArbStats.bgYieldTimeMs += phNxpEse_getTimeMs() - startTime;
+      }
+    }
+  }
+  return status;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_recordWait
+ *
+ * Description      This function counts an arbitration wait in its
+ *                  ESE_ARB_WAIT_BUCKETS histogram bucket, called with
+ *                  gTransceiveGate held
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+static void phNxpEse_recordWait(uint32_t* pHist, uint64_t waitMs) {
+  uint32_t bucket = 0;
+  while ((waitMs != 0) && (bucket < (ESE_ARB_WAIT_BUCKETS - 1))) {
+    waitMs >>= 1;
+    bucket++;
+  }
+  pHist[bucket]++;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_apduChannel
+ *
+ * Description      This function returns the logical channel encoded in CLA
+ *
+ * Returns          Channel number
+ *
+ ******************************************************************************/
+static uint8_t phNxpEse_apduChannel(uint8_t cla) {
+  if ((cla & 0x40) == 0x40) return 0x04 + (cla & 0x0F);
+  return (cla & 0x03);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_SetAutoGetResponse
+ *
+ * Description      This function enables/disables automatic 61xx/6Cxx
+ *                  handling for a logical channel
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_SetAutoGetResponse(uint8_t channel, bool enable) {
+  if (channel >= ESE_MAX_LOGICAL_CHANNELS) return ESESTATUS_INVALID_PARAMETER;
+  SyncEventGuard guard(gTransceiveGate);
+  if (enable)
+    gAutoRespRuntimeMask |= (1U << channel);
+  else
+    gAutoRespRuntimeMask &= ~(1U << channel);
+  ALOGD_IF(ese_debug_enabled, "%s channel %d enable %d", __FUNCTION__, channel,
+           enable);
+  return ESESTATUS_SUCCESS;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_SetChannelOwner
+ *
+ * Description      This function records the client holding a logical
+ *                  channel through SecureElement, owner 0 releases it. Waits
+ *                  for a checked exchange in progress.
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_SetChannelOwner(uint8_t channel, uint32_t owner) {
+  if (channel >= ESE_MAX_LOGICAL_CHANNELS) return ESESTATUS_INVALID_PARAMETER;
+  SyncEventGuard guard(gChannelOwnerLock);
+  gChannelOwner[channel] = owner;
+  ALOGD_IF(ese_debug_enabled, "%s channel %d owner %u", __FUNCTION__, channel,
+           owner);
+  return ESESTATUS_SUCCESS;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_isChannelAllowed
+ *
+ * Description      This function checks, with gChannelOwnerLock held, that
+ *                  owner may send pCmd: no MANAGE CHANNEL, and a channel it
+ *                  holds or the basic channel while nobody holds it
+ *
+ * Returns          true if the APDU may be sent
+ *
+ ******************************************************************************/
+static bool phNxpEse_isChannelAllowed(const phNxpEse_data* pCmd,
+                                      uint32_t owner) {
+  if ((pCmd->p_data == NULL) || (pCmd->len < 4)) return false;
+  /* MANAGE CHANNEL would change the channels behind SecureElement */
+  if (pCmd->p_data[1] == 0x70) return false;
+  uint8_t channel = phNxpEse_apduChannel(pCmd->p_data[0]);
+  if (channel >= ESE_MAX_LOGICAL_CHANNELS) return false;
+  if (gChannelOwner[channel] == owner) return true;
+  return (channel == 0) && (gChannelOwner[channel] == 0);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_TransceiveAutoResp
+ *
+ * Description      This function exchanges an APDU like phNxpEse_Transceive
+ *                  and, if enabled for the channel, resolves 6Cxx by one
+ *                  re-send with the corrected Le and 61xx by chaining
+ *                  GET RESPONSE. Chaining stops at gAutoRespMaxLen, the
+ *                  pending 61xx is then returned to the caller.
+ *                  If timeoutMs is not 0, arbitration waits, the RF-off
+ *                  wait, response polling, WTX and recovery of all the
+ *                  exchanges stop at one deadline. An exchange cut short is
+ *                  resynchronized before the next transceive.
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_TransceiveAutoResp(phNxpEse_data* pCmd,
+                                      phNxpEse_data* pRsp,
+                                      uint32_t timeoutMs) {
+  phNxpEse_TransceiveOpts_t opts = {NULL, NULL, 0, 0};
+  if (timeoutMs != 0) opts.deadline = phNxpEse_getTimeMs() + timeoutMs;
+  ESESTATUS status = phNxpEse_fgTransceive(pCmd, pRsp, &opts);
+  if ((status != ESESTATUS_SUCCESS) || (pCmd->len < 4) || (pRsp->len < 2))
+    return status;
+
+  uint8_t cla = pCmd->p_data[0];
+  uint8_t channel = phNxpEse_apduChannel(cla);
+  {
+    SyncEventGuard guard(gTransceiveGate);
+    if (((gAutoRespConfigMask | gAutoRespRuntimeMask) & (1U << channel)) == 0)
+      return status;
+  }
+
+  /* 6Cxx: wrong Le, re-send once with Le = xx (case 2 and case 4 short) */
+  if ((pRsp->len == 2) && (pRsp->p_data[0] == 0x6C) &&
+      ((pCmd->len == 5) || (pCmd->len == (uint32_t)(6 + pCmd->p_data[4])))) {
+    phNxpEse_data cmd;
+    cmd.len = pCmd->len;
+    cmd.p_data = (uint8_t*)phNxpEse_memalloc(cmd.len);
+    if (cmd.p_data == NULL) return status;
+    phNxpEse_memcpy(cmd.p_data, pCmd->p_data, cmd.len);
+    cmd.p_data[cmd.len - 1] = pRsp->p_data[1];
+    phNxpEse_free(pRsp->p_data);
+    phNxpEse_memset(pRsp, 0x00, sizeof(phNxpEse_data));
+    status = phNxpEse_fgTransceive(&cmd, pRsp, &opts);
+    phNxpEse_free(cmd.p_data);
+    if ((status != ESESTATUS_SUCCESS) || (pRsp->len < 2)) return status;
+  }
+
+  /* 61xx: gather the remaining data with GET RESPONSE on the same channel */
+  uint8_t getResp[] = {(uint8_t)(((cla & 0x40) == 0x40) ? (cla & 0x4F)
+                                                         : (cla & 0x03)),
+                       0xC0, 0x00, 0x00, 0x00};
+  phNxpEse_data getRespCmd = {sizeof(getResp), getResp};
+  while ((pRsp->p_data[pRsp->len - 2] == 0x61) &&
+         ((pRsp->len - 2) < gAutoRespMaxLen)) {
+    phNxpEse_data next;
+    phNxpEse_memset(&next, 0x00, sizeof(phNxpEse_data));
+    getResp[4] = pRsp->p_data[pRsp->len - 1];
+    status = phNxpEse_fgTransceive(&getRespCmd, &next, &opts);
+    if ((status != ESESTATUS_SUCCESS) || (next.len < 2)) {
+      /* Keep the data gathered so far, caller sees the pending 61xx */
+      phNxpEse_free(next.p_data);
+      status = ESESTATUS_SUCCESS;
+      break;
+    }
+    /* Replace the SW of the data gathered so far by the new response */
+    uint32_t dataLen = pRsp->len - 2;
+    uint8_t* buf = (uint8_t*)phNxpEse_memalloc(dataLen + next.len);
+    if (buf == NULL) {
+      phNxpEse_free(next.p_data);
+      break;
+    }
+    phNxpEse_memcpy(buf, pRsp->p_data, dataLen);
+    phNxpEse_memcpy(buf + dataLen, next.p_data, next.len);
+    phNxpEse_free(pRsp->p_data);
+    phNxpEse_free(next.p_data);
+    pRsp->p_data = buf;
+    pRsp->len = dataLen + next.len;
+  }
+  return status;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_leaseEnded
+ *
+ * Description      This function ends the active lease, with gTransceiveGate
+ *                  held. The lease a priority lease paused resumes with its
+ *                  remaining time unless another priority lease is pending.
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+static void phNxpEse_leaseEnded(void) {
+  gLeaseId = 0;
+  gLeaseIsPrio = false;
+  if ((gPausedLeaseId != 0) && (gPrioPendingCount == 0)) {
+    gLeaseId = gPausedLeaseId;
+    gLeaseDeadline = phNxpEse_getTimeMs() + gPausedLeaseRemaining;
+    gPausedLeaseId = 0;
+    ALOGD_IF(ese_debug_enabled, "%s lease %llu resumed for %llu ms",
+             __FUNCTION__, (unsigned long long)gLeaseId,
+             (unsigned long long)gPausedLeaseRemaining);
+  }
+  gTransceiveGate.notifyAll();
+}
+
+/******************************************************************************
+ * Function         phNxpEse_leaseBlocks
+ *
+ * Description      This function checks, with gTransceiveGate held, whether
+ *                  a lease excludes other clients. An expired lease is
+ *                  dropped here. A pending priority lease holds everybody
+ *                  at the next APDU boundary.
+ *
+ * Returns          true while the lease or its last APDU is active
+ *
+ ******************************************************************************/
+static bool phNxpEse_leaseBlocks(void) {
+  if ((gLeaseId != 0) && (phNxpEse_getTimeMs() >= gLeaseDeadline)) {
+    ALOGE("%s lease %llu expired", __FUNCTION__, (unsigned long long)gLeaseId);
+    phNxpEse_leaseEnded();
+  }
+  return (gLeaseId != 0) || gLeaseApduInFlight || (gPrioPendingCount > 0);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_waitLease
+ *
+ * Description      This function waits, with gTransceiveGate held, until no
+ *                  lease excludes the caller. Bounded by the lease deadline
+ *                  and, if not 0, by the caller's deadline.
+ *
+ * Returns          false if the caller's deadline passed first
+ *
+ ******************************************************************************/
+static bool phNxpEse_waitLease(uint64_t deadline) {
+  bool available = true;
+  if (!phNxpEse_leaseBlocks()) return available;
+  uint64_t startTime = phNxpEse_getTimeMs();
+  while (phNxpEse_leaseBlocks()) {
+    uint64_t now = phNxpEse_getTimeMs();
+    uint64_t waitTime =
+        (gLeaseId != 0) ? (gLeaseDeadline - now) : ESE_FG_MAX_WAIT_TIME;
+    if (deadline != 0) {
+      if (now >= deadline) {
+        available = false;
+        break;
+      }
+      if ((deadline - now) < waitTime) waitTime = deadline - now;
+    }
+    gTransceiveGate.wait(waitTime);
+  }
+  gArbStats.leaseWaitTimeMs += phNxpEse_getTimeMs() - startTime;
+  return available;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_AcquireLease
+ *
+ * Description      This function grants exclusive eSE access for durationMs
+ *                  once in-flight APDUs of other clients completed and
+ *                  pending foreground requests were served
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_AcquireLease(uint32_t durationMs, uint64_t* pLeaseId) {
+  if ((pLeaseId == NULL) || (durationMs == 0))
+    return ESESTATUS_INVALID_PARAMETER;
+  if (durationMs > ESE_LEASE_MAX_TIME) durationMs = ESE_LEASE_MAX_TIME;
+
+  SyncEventGuard guard(gTransceiveGate);
+  uint64_t startTime = phNxpEse_getTimeMs();
+  uint64_t elapsed = 0;
+  while ((phNxpEse_leaseBlocks() || gBgApduInFlight || (gFgPendingCount > 0)) &&
+         (elapsed < ESE_FG_MAX_WAIT_TIME)) {
+    gTransceiveGate.wait(ESE_FG_MAX_WAIT_TIME - elapsed);
+    elapsed = phNxpEse_getTimeMs() - startTime;
+  }
+  if (phNxpEse_leaseBlocks() || gBgApduInFlight || (gFgPendingCount > 0)) {
+    ALOGE("%s eSE busy", __FUNCTION__);
+    return ESESTATUS_BUSY;
+  }
+  gLeaseId = ++gLeaseSeq;
+  gLeaseDeadline = phNxpEse_getTimeMs() + durationMs;
+  gArbStats.leaseCount++;
+  *pLeaseId = gLeaseId;
+  ALOGD_IF(ese_debug_enabled, "%s lease %llu for %u ms", __FUNCTION__,
+           (unsigned long long)gLeaseId, durationMs);
+  return ESESTATUS_SUCCESS;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_AcquirePrioLease
+ *
+ * Description      This function grants a priority lease as soon as the APDU
+ *                  in flight, whoever sent it, completed. Other clients are
+ *                  held at their next APDU boundary and an active lease is
+ *                  paused. The time-to-device is bounded by
+ *                  NXP_PRIO_MAX_WAIT_TIME.
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_AcquirePrioLease(uint32_t durationMs, uint64_t* pLeaseId) {
+  if ((pLeaseId == NULL) || (durationMs == 0))
+    return ESESTATUS_INVALID_PARAMETER;
+  if (durationMs > ESE_LEASE_MAX_TIME) durationMs = ESE_LEASE_MAX_TIME;
+
+  SyncEventGuard guard(gTransceiveGate);
+  uint64_t startTime = phNxpEse_getTimeMs();
+  uint64_t elapsed = 0;
+  bool available = false;
+  gPrioPendingCount++;
+  for (;;) {
+    phNxpEse_leaseBlocks();
+    if ((gLeaseId != 0) && !gLeaseIsPrio) {
+      /* Normal lease, resumed by phNxpEse_leaseEnded */
+      gPausedLeaseId = gLeaseId;
+      gPausedLeaseRemaining = gLeaseDeadline - phNxpEse_getTimeMs();
+      gLeaseId = 0;
+      gArbStats.prioPreemptCount++;
+      ALOGD_IF(ese_debug_enabled, "%s lease %llu paused", __FUNCTION__,
+               (unsigned long long)gPausedLeaseId);
+    }
+    available = (gLeaseId == 0) && !gLeaseApduInFlight && !gBgApduInFlight &&
+                (gFgActiveCount == 0);
+    if (available || (elapsed >= gPrioMaxWaitTime)) break;
+    gTransceiveGate.wait(gPrioMaxWaitTime - elapsed);
+    elapsed = phNxpEse_getTimeMs() - startTime;
+  }
+  gPrioPendingCount--;
+
+  if (!available) {
+    gArbStats.prioTimeoutCount++;
+    ALOGE("%s eSE not freed within %u ms", __FUNCTION__, gPrioMaxWaitTime);
+    if (gLeaseId == 0) phNxpEse_leaseEnded();
+    gTransceiveGate.notifyAll();
+    return ESESTATUS_BUSY;
+  }
+  gLeaseId = ++gLeaseSeq;
+  gLeaseIsPrio = true;
+  gLeaseDeadline = phNxpEse_getTimeMs() + durationMs;
+  gArbStats.prioCount++;
+  gArbStats.prioWaitTimeMs += elapsed;
+  if (elapsed > gArbStats.prioWaitMaxMs) gArbStats.prioWaitMaxMs = elapsed;
+  *pLeaseId = gLeaseId;
+  ALOGD_IF(ese_debug_enabled, "%s lease %llu for %u ms after %llu ms",
+           __FUNCTION__, (unsigned long long)gLeaseId, durationMs,
+           (unsigned long long)elapsed);
+  return ESESTATUS_SUCCESS;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_ReleaseLease
+ *
+ * Description      This function ends the active lease, or a lease paused by
+ *                  a priority lease
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_ReleaseLease(uint64_t leaseId) {
+  SyncEventGuard guard(gTransceiveGate);
+  if ((leaseId != 0) && (leaseId == gPausedLeaseId)) {
+    gPausedLeaseId = 0;
+    ALOGD_IF(ese_debug_enabled, "%s paused lease %llu", __FUNCTION__,
+             (unsigned long long)leaseId);
+    return ESESTATUS_SUCCESS;
+  }
+  if ((leaseId == 0) || (leaseId != gLeaseId)) {
+    return ESESTATUS_INVALID_PARAMETER;
+  }
+  phNxpEse_leaseEnded();
+  ALOGD_IF(ese_debug_enabled, "%s lease %llu", __FUNCTION__,
+           (unsigned long long)leaseId);
+  return ESESTATUS_SUCCESS;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_LeaseTransceive
+ *
+ * Description      This function exchanges an APDU for the lease holder,
+ *                  without the per APDU foreground/background arbitration.
+ *                  If owner is not 0 the channel is checked as by
+ *                  phNxpEse_ClientTransceive.
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_LeaseTransceive(uint64_t leaseId, uint32_t owner,
+                                   phNxpEse_data* pCmd, phNxpEse_data* pRsp) {
+  phNxpEse_TransceiveOpts_t opts = {NULL, NULL, 0, owner};
+  ESESTATUS status = ESESTATUS_FAILED;
+  {
+    SyncEventGuard guard(gTransceiveGate);
+    /* A paused lease continues once the priority lease ended */
+    uint64_t startTime = phNxpEse_getTimeMs();
+    uint64_t elapsed = 0;
+    while ((leaseId != 0) && (leaseId == gPausedLeaseId) &&
+           (elapsed < ESE_LEASE_MAX_TIME)) {
+      gTransceiveGate.wait(ESE_LEASE_MAX_TIME - elapsed);
+      elapsed = phNxpEse_getTimeMs() - startTime;
+    }
+    if ((leaseId == 0) || !phNxpEse_leaseBlocks() || (leaseId != gLeaseId) ||
+        gLeaseApduInFlight) {
+      return ESESTATUS_NOT_ALLOWED;
+    }
+    /* Keeps others out even if the deadline passes during this APDU */
+    gLeaseApduInFlight = true;
+  }
+
+  status = phNxpEse_doTransceive(pCmd, pRsp, &opts);
+
+  {
+    SyncEventGuard guard(gTransceiveGate);
+    gLeaseApduInFlight = false;
+    gArbStats.leaseApduCount++;
+    gTransceiveGate.notifyAll();
+  }
+  return status;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_GetArbStats
+ *
+ * Description      This function copies the foreground/background transceive
+ *                  arbitration statistics
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+void phNxpEse_GetArbStats(phNxpEse_ArbStats_t* pStats) {
+  if (pStats == NULL) return;
+  SyncEventGuard guard(gTransceiveGate);
+  phNxpEse_memcpy(pStats, &gArbStats, sizeof(phNxpEse_ArbStats_t));
+}
+
+/******************************************************************************
+ * Function         phNxpEse_pwrWindowSetReady
+ *
+ * Description      This function tracks whether the eSE session is usable
+ *                  by deferrable requests. Called on successful init and at
+ *                  close, whoever opened the session.
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+static void phNxpEse_pwrWindowSetReady(bool ready) {
+  SyncEventGuard guard(gPwrWindowEvent);
+  gPwrWindowReady = ready;
+  if (!ready) gPwrWindowOwned = false;
+  gPwrWindowEvent.notifyAll();
+}
+
+/******************************************************************************
+ * Function         phNxpEse_HoldPowerWindow
+ *
+ * Description      This function is used by deferrable requests. It joins
+ *                  the open eSE session or waits up to maxDelayMs for one
+ *                  to be opened by another client. Past that it opens the
+ *                  session itself, other deferrable requests waiting at
+ *                  that time join it, so they all share one power window.
+ *                  Every successful call must be paired with
+ *                  phNxpEse_ReleasePowerWindow.
+ *
+ * Returns          On Success ESESTATUS_SUCCESS else proper error code
+ *
+ ******************************************************************************/
+ESESTATUS phNxpEse_HoldPowerWindow(uint32_t maxDelayMs) {
+  ESESTATUS status = ESESTATUS_FAILED;
+  uint64_t startTime = phNxpEse_getTimeMs();
+  uint64_t elapsed = 0;
+  phNxpEse_initParams initParams;
+
+  if (maxDelayMs > ESE_PWR_WINDOW_MAX_DELAY)
+    maxDelayMs = ESE_PWR_WINDOW_MAX_DELAY;
+  {
+    SyncEventGuard guard(gPwrWindowEvent);
+    gPwrWindowStats.requestCount++;
+    /* Once the tolerance is spent, still wait for a window the scheduler
+     * is already opening for another request */
+    while (!gPwrWindowReady &&
+           (gPwrWindowTransit || (elapsed < maxDelayMs))) {
+      gPwrWindowEvent.wait(gPwrWindowTransit ? ESE_FG_MAX_WAIT_TIME
+                                             : (maxDelayMs - elapsed));
+      elapsed = phNxpEse_getTimeMs() - startTime;
+    }
+    gPwrWindowStats.delayTimeMs += elapsed;
+    if (gPwrWindowReady) {
+      gPwrWindowHolders++;
+      gPwrWindowStats.joinedCount++;
+      ALOGD_IF(ese_debug_enabled, "%s joined after %llu ms, holders %u",
+               __FUNCTION__, (unsigned long long)elapsed, gPwrWindowHolders);
+      return ESESTATUS_SUCCESS;
+    }
+    gPwrWindowTransit = true;
+  }
+
+  phNxpEse_memset(&initParams, 0x00, sizeof(phNxpEse_initParams));
+  initParams.initMode = ESE_MODE_NORMAL;
+  status = phNxpEse_open(initParams);
+  if (status == ESESTATUS_SUCCESS) {
+    status = phNxpEse_init(initParams);
+    if (status != ESESTATUS_SUCCESS) phNxpEse_close();
+  }
+
+  SyncEventGuard guard(gPwrWindowEvent);
+  gPwrWindowTransit = false;
+  if ((status == ESESTATUS_SUCCESS) && gPwrWindowReady) {
+    gPwrWindowOwned = true;
+    gPwrWindowHolders++;
+    gPwrWindowStats.openedCount++;
+    ALOGD_IF(ese_debug_enabled, "%s opened after %llu ms", __FUNCTION__,
+             (unsigned long long)elapsed);
+  } else if (gPwrWindowReady) {
+    /* Lost the race against another client opening the session */
+    gPwrWindowHolders++;
+    gPwrWindowStats.joinedCount++;
+    status = ESESTATUS_SUCCESS;
+  } else {
+    ALOGE("%s eSE open failed", __FUNCTION__);
+    status = ESESTATUS_FAILED;
+  }
+  gPwrWindowEvent.notifyAll();
+  return status;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_ReleasePowerWindow
+ *
+ * Description      This function ends a deferrable request. The last one
+ *                  closes the session if the scheduler owns it.
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+void phNxpEse_ReleasePowerWindow(void) {
+  {
+    SyncEventGuard guard(gPwrWindowEvent);
+    if (gPwrWindowHolders == 0) return;
+    gPwrWindowHolders--;
+    gPwrWindowEvent.notifyAll();
+    if ((gPwrWindowHolders > 0) || !gPwrWindowOwned || !gPwrWindowReady)
+      return;
+    /* Nobody may join a window about to close */
+    gPwrWindowReady = false;
+    gPwrWindowOwned = false;
+    gPwrWindowTransit = true;
+  }
+  ALOGD_IF(ese_debug_enabled, "%s closing scheduler window", __FUNCTION__);
+  if (phNxpEse_deInit() != ESESTATUS_SUCCESS)
+    ALOGE("%s phNxpEse_deInit failed", __FUNCTION__);
+  if (phNxpEse_close() != ESESTATUS_SUCCESS)
+    ALOGE("%s phNxpEse_close failed", __FUNCTION__);
+
+  SyncEventGuard guard(gPwrWindowEvent);
+  gPwrWindowTransit = false;
+  gPwrWindowEvent.notifyAll();
+}
+
+/******************************************************************************
+ * Function         phNxpEse_isDeferredWindow
+ *
+ * Description      This function checks whether the open session is owned
+ *                  by the scheduler rather than by a foreground client
+ *
+ * Returns          true for a scheduler owned session
+ *
+ ******************************************************************************/
+bool phNxpEse_isDeferredWindow(void) {
+  SyncEventGuard guard(gPwrWindowEvent);
+  return gPwrWindowOwned || gPwrWindowTransit;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_AdoptPowerWindow
+ *
+ * Description      This function lets the foreground client take over a
+ *                  session opened by the scheduler instead of opening its
+ *                  own. Waits for a scheduler open/close in progress.
+ *
+ * Returns          true if the session was adopted and is open
+ *
+ ******************************************************************************/
+bool phNxpEse_AdoptPowerWindow(void) {
+  SyncEventGuard guard(gPwrWindowEvent);
+  uint64_t startTime = phNxpEse_getTimeMs();
+  uint64_t elapsed = 0;
+  while (gPwrWindowTransit && (elapsed < ESE_FG_MAX_WAIT_TIME)) {
+    gPwrWindowEvent.wait(ESE_FG_MAX_WAIT_TIME - elapsed);
+    elapsed = phNxpEse_getTimeMs() - startTime;
+  }
+  if (!gPwrWindowReady || !gPwrWindowOwned) return false;
+  gPwrWindowOwned = false;
+  gPwrWindowStats.adoptedCount++;
+  ALOGD_IF(ese_debug_enabled, "%s holders %u", __FUNCTION__,
+           gPwrWindowHolders);
+  return true;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_HandOverPowerWindow
+ *
+ * Description      This function is called by the foreground client before
+ *                  closing its session. While deferrable requests are still
+ *                  inside the window, the scheduler takes the session over
+ *                  and closes it after the last one.
+ *
+ * Returns          true if the session was handed over and must stay open
+ *
+ ******************************************************************************/
+bool phNxpEse_HandOverPowerWindow(void) {
+  SyncEventGuard guard(gPwrWindowEvent);
+  if (!gPwrWindowReady || (gPwrWindowHolders == 0)) return false;
+  gPwrWindowOwned = true;
+  ALOGD_IF(ese_debug_enabled, "%s holders %u", __FUNCTION__,
+           gPwrWindowHolders);
+  return true;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_GetPwrWindowStats
+ *
+ * Description      This function copies the power window statistics
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+void phNxpEse_GetPwrWindowStats(phNxpEse_PwrWindowStats_t* pStats) {
+  if (pStats == NULL) return;
+  SyncEventGuard guard(gPwrWindowEvent);
+  phNxpEse_memcpy(pStats, &gPwrWindowStats, sizeof(phNxpEse_PwrWindowStats_t));
+}
+
+/******************************************************************************
+ * Function         phNxpEse_recordRfBlock
+ *
+ * Description      This function accounts the time a transceive was held
+ *                  because SPI was suspended for active RF
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+void phNxpEse_recordRfBlock(uint64_t blockedMs, bool allowed) {
+  SyncEventGuard guard(gTransceiveGate);
+  gArbStats.rfBlockCount++;
+  if (!allowed) gArbStats.rfBlockFailCount++;
+  gArbStats.rfBlockTimeMs += blockedMs;
+  if (blockedMs > gArbStats.rfBlockMaxMs) gArbStats.rfBlockMaxMs = blockedMs;
+}
+
 /******************************************************************************
  * Function         phNxpEse_reset
  *
@@ -664,6 +1808,8 @@ ESESTATUS phNxpEse_reset(void) {
 
   /* TBD : Call the ioctl to reset the ESE */
   ALOGD_IF(ese_debug_enabled, " %s Enter \n", __FUNCTION__);
+  phNxpEse_InvalidateContent();
+  phNxpEseProto7816_MarkCold();
   /* Do an interface reset, don't wait to see if JCOP went through a full power
    * cycle or not */
   ESESTATUS bStatus = phNxpEseProto7816_IntfReset(
@@ -722,6 +1868,8 @@ ESESTATUS phNxpEse_resetJcopUpdate(void) {
 
   /* TBD : Call the ioctl to reset the  */
   ALOGD_IF(ese_debug_enabled, " %s Enter \n", __FUNCTION__);
+  phNxpEse_InvalidateContent();
+  phNxpEseProto7816_MarkCold();
 
   /* Reset interface after every reset irrespective of
   whether JCOP did a full power cycle or not. */
@@ -802,6 +1950,8 @@ ESESTATUS phNxpEse_EndOfApdu(void) {
 ESESTATUS phNxpEse_chipReset(void) {
   ESESTATUS status = ESESTATUS_SUCCESS;
   ESESTATUS bStatus = ESESTATUS_FAILED;
+  phNxpEse_InvalidateContent();
+  phNxpEseProto7816_MarkCold();
   if (nxpese_ctxt.pwr_scheme == PN80T_EXT_PMU_SCHEME) {
     bStatus = phNxpEseProto7816_Reset();
     if (!bStatus) {
@@ -854,6 +2004,7 @@ ESESTATUS phNxpEse_close(void) {
     ALOGE(" %s ESE Not Initialized \n", __FUNCTION__);
     return ESESTATUS_NOT_INITIALISED;
   }
+  phNxpEse_pwrWindowSetReady(false);
 
 #ifdef SPM_INTEGRATED
   ESESTATUS wSpmStatus = ESESTATUS_SUCCESS;
@@ -879,6 +2030,20 @@ ESESTATUS phNxpEse_close(void) {
   if (wSpmStatus != ESESTATUS_SUCCESS) {
     ALOGE("phNxpEse_SPM_DeInit Failed");
   }
+  phNxpEse_SpmStats_t spmStats;
+  phNxpEse_SPM_GetStats(&spmStats);
+  ALOGD_IF(ese_debug_enabled, "%s SPM driver calls=%u skipped=%u", __FUNCTION__,
+           spmStats.ioctlCount, spmStats.skippedCount);
+  if (spmStats.elapsedMs != 0) {
+    ALOGD_IF(ese_debug_enabled,
+             "%s SPM power cycles=%u (%llu/h) on-time=%llu ms (%llu ms/h)",
+             __FUNCTION__, spmStats.pwrCycleCount,
+             (unsigned long long)((uint64_t)spmStats.pwrCycleCount * 3600000 /
+                                  spmStats.elapsedMs),
+             (unsigned long long)spmStats.pwrOnTimeMs,
+             (unsigned long long)(spmStats.pwrOnTimeMs * 3600000 /
+                                  spmStats.elapsedMs));
+  }
 
 #endif
   if (NULL != nxpese_ctxt.pDevHandle) {
@@ -969,6 +2134,10 @@ static int phNxpEse_readPacket(void* pDevHandle, uint8_t* pBuffer,
       headerIndex = 0;
       break;
     }
+    if (phNxpEse_deadlineExpired()) {
+      ALOGE("%s deadline passed while polling for SOF", __FUNCTION__);
+      break;
+    }
     ALOGD_IF(ese_debug_enabled, "%s Normal Pkt, delay read %dus", __FUNCTION__,
              READ_WAKE_UP_DELAY * NAD_POLLING_SCALER);
     phPalEse_sleep(READ_WAKE_UP_DELAY * NAD_POLLING_SCALER);
@@ -1201,14 +2370,14 @@ static ESESTATUS phNxpEse_checkFWDwnldStatus(void) {
   ALOGE("phNxpEse_checkFWDwnldStatus Enter");
   ESESTATUS wSpmStatus = ESESTATUS_SUCCESS;
   spm_state_t current_spm_state = SPM_STATE_INVALID;
-  uint8_t ese_dwnld_retry = 0x00;
+  uint64_t deadline = phNxpEse_getTimeMs() + ESE_FW_DWNLD_MAX_WAIT;
   ESESTATUS status = ESESTATUS_FAILED;
 
   wSpmStatus = phNxpEse_SPM_GetState(&current_spm_state);
   if (wSpmStatus == ESESTATUS_SUCCESS) {
     /* Check current_spm_state and update config/Spm status*/
-    while (ese_dwnld_retry < ESE_FW_DWNLD_RETRY_CNT) {
-      ALOGE("ESE_FW_DWNLD_RETRY_CNT retry count");
+    for (;;) {
+      uint32_t dwnldStateSeq = phPalEse_spi_getDwnldStateSeq();
       wSpmStatus = phNxpEse_SPM_GetState(&current_spm_state);
       if (wSpmStatus == ESESTATUS_SUCCESS) {
         if ((current_spm_state & SPM_STATE_DWNLD)) {
@@ -1222,8 +2391,15 @@ static ESESTATUS phNxpEse_checkFWDwnldStatus(void) {
         status = ESESTATUS_FAILED;
         break;
       }
-      phNxpEse_Sleep(500000); /*sleep for 500 ms checking for fw dwnld status*/
-      ese_dwnld_retry++;
+      /*Re-check as soon as NFC HAL reports the end of the download, else
+       * every ESE_FW_DWNLD_POLL_TIME ms, until the deadline set at entry*/
+      uint64_t now = phNxpEse_getTimeMs();
+      if (now >= deadline) break;
+      phPalEse_spi_waitDwnldState(
+          dwnldStateSeq, ((deadline - now) < ESE_FW_DWNLD_POLL_TIME)
+                             ? (deadline - now)
+                             : ESE_FW_DWNLD_POLL_TIME);
+      phNxpEse_SPM_InvalidateState();
     }
   }
 
@@ -1231,6 +2407,17 @@ static ESESTATUS phNxpEse_checkFWDwnldStatus(void) {
   return status;
 }
 #endif
+/******************************************************************************
+ * Function         phNxpEse_GetWtxCount
+ *
+ * Description      This function returns the number of WTX requests received
+ *                  from ESE since the library was loaded
+ *
+ * Returns          Cumulative WTX count
+ *
+ ******************************************************************************/
+uint32_t phNxpEse_GetWtxCount(void) { return phNxpEseProto7816_GetWtxCount(); }
+
 /******************************************************************************
  * Function         phNxpEse_GetEseStatus(unsigned char *timer_buffer)
  *
@@ -50,12 +50,21 @@ typedef enum {
 #define SECOND_TO_MILLISECOND(X) X * 1000
 #define CONVERT_TO_PERCENTAGE(X, Y) X* Y / 100
 #define ADDITIONAL_SECURE_TIME_PERCENTAGE 5
+#define ESE_BG_DUTY_CYCLE_DEFAULT 100 /* Background transceive not throttled*/
+#define ESE_BG_MAX_YIELD_TIME 1000 /* Max background yield in ms */
+#define ESE_FG_MAX_WAIT_TIME 5000 /* Max foreground wait for background APDU*/
+#define ESE_AUTO_GET_RESP_MAX_LEN 0x10000 /* Max chained GET RESPONSE data */
+#define ESE_LEASE_MAX_TIME 10000 /* Max exclusive lease duration in ms */
+#define ESE_PRIO_MAX_WAIT_TIME 500 /* Max priority lease time-to-device, ms */
+#define ESE_PWR_WINDOW_MAX_DELAY 60000 /* Max deferrable request delay in ms */
+#define ESE_MAX_LOGICAL_CHANNELS 20       /* Basic + 19 logical channels */
 #ifdef NXP_ESE_JCOP_DWNLD_PROTECTION
-#define ESE_JCOP_OS_DWNLD_RETRY_CNT \
-  10 /* Maximum retry count for ESE JCOP OS Dwonload*/
+#define ESE_JCOP_DWNLD_MAX_WAIT 2000 /* JCOP dwnld state wait, in ms */
+#define ESE_JCOP_DWNLD_POLL_TIME 200 /* JCOP dwnld state re-check, in ms */
 #endif
 #ifdef NXP_NFCC_SPI_FW_DOWNLOAD_SYNC
-#define ESE_FW_DWNLD_RETRY_CNT 10 /* Maximum retry count for FW Dwonload*/
+#define ESE_FW_DWNLD_MAX_WAIT 5000 /* FW dwnld end wait, in ms */
+#define ESE_FW_DWNLD_POLL_TIME 500 /* FW dwnld state re-check, in ms */
 #endif
 
 /* Secure timer values F1, F2, F3 */
@@ -65,6 +74,21 @@ typedef struct phNxpEse_SecureTimer {
   unsigned int secureTimer3;
 } phNxpEse_SecureTimer_t;
 
+/* Per transceive options, unused members are NULL/0 */
+typedef struct phNxpEse_TransceiveOpts {
+  phNxpEse_RspChunkCb_t pRspCb; /* streaming response sink */
+  void* pContext;               /* context passed to the sink */
+  uint64_t deadline;            /* phNxpEse_getTimeMs() deadline, 0: none */
+  uint32_t owner;               /* client checked against channel owners */
+} phNxpEse_TransceiveOpts_t;
+
+/* Deadline of the transceive in progress */
+bool phNxpEse_deadlineExpired(void);
+uint32_t phNxpEse_deadlineBound(uint32_t waitMs);
+
+/* Accounts a transceive held by active RF */
+void phNxpEse_recordRfBlock(uint64_t blockedMs, bool allowed);
+
 /* JCOP download states */
 typedef enum jcop_dwnld_state {
 #ifdef NXP_ESE_JCOP_DWNLD_PROTECTION
@@ -91,6 +115,7 @@ typedef struct phNxpEse_Context {
   phNxpEse_SecureTimer_t secureTimerParams;
 } phNxpEse_Context_t;
 
+uint64_t phNxpEse_getTimeMs(void);
 ESESTATUS phNxpEse_WriteFrame(uint32_t data_len, const uint8_t* p_data);
 ESESTATUS phNxpEse_read(uint32_t* data_len, uint8_t** pp_data);
 
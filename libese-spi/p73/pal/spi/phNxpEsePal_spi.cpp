@@ -27,6 +27,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
@@ -43,8 +44,11 @@
 #include <phNxpEsePal_spi.h>
 #include <string.h>
 
-#define MAX_RETRY_CNT 10
+#define MAX_RETRY_CNT 100
+#define OPEN_RETRY_DELAY 100000 /* EBUSY poll interval, in us */
 #define HAL_NFC_SPI_DWP_SYNC 21
+#define DWP_ACCESS_RETRY_CNT 5
+#define DWP_ACCESS_WAIT_TIME 2000 /* max. wait for a DWP release, in ms */
 #define RF_ON 1
 #define SHA1_LEN 20
 
@@ -58,8 +62,27 @@ unsigned long configNum1, configNum2, gFelicaAppTimeout;
 
 static const uint8_t MAX_SPI_WRITE_RETRY_COUNT_HW_ERR = 3;
 static IntervalTimer sTimerInstance;
+/* DWP release events from NFC HAL (explicit notification or RF off) */
+static SyncEvent gDwpReleaseEvent;
+static uint32_t gDwpReleaseSeq = 0;
+static void phPalEse_spi_notifyDwpRelease(void);
+/* NFCC FW / JCOP download state changes reported by NFC HAL */
+static SyncEvent gDwnldStateEvent;
+static uint32_t gDwnldStateSeq = 0;
+static void phPalEse_spi_notifyDwnldState(void);
+static bool phPalEse_spi_waitSeq(SyncEvent& event, const uint32_t& curSeq,
+                                 uint32_t seq, unsigned long timeoutMs);
 
 uint8_t gMfcAppSessionCount = 0;
+/* SPI availability published to the registered callback */
+static pthread_mutex_t gSpiAvailLock = PTHREAD_MUTEX_INITIALIZER;
+static phNxpEse_SpiAvailabilityCb_t gSpiAvailCb = NULL;
+static phNxpEse_SpiAvailability_t gSpiAvailState = ESE_SPI_AVAILABLE;
+static uint8_t gSpiAvailSessions = 0;
+static uint32_t gSpiAvailNtfCount = 0;
+static void phPalEse_spi_publishAvailability(bool rfBusy);
+static void phPalEse_spi_publishSessions(void);
+static void phPalEse_spi_updateAvailability(bool keepRf, bool rfBusy);
 static std::vector<uint8_t> gOmapiAppSignature1(20, 0xFF);
 static std::vector<uint8_t> gOmapiAppSignature2(20, 0xFF);
 static std::vector<uint8_t> gOmapiAppSignature3(20, 0xFF);
@@ -135,6 +158,7 @@ ESESTATUS phNxpEse_spiIoctl(uint64_t ioctlType, void* p_data) {
       } else {
         StateMachine::GetInstance().ProcessExtEvent(EVT_RF_ON);
       }
+      phPalEse_spi_publishAvailability(true);
     } else {
       ALOGD_IF(
           ese_debug_enabled,
@@ -150,14 +174,24 @@ ESESTATUS phNxpEse_spiIoctl(uint64_t ioctlType, void* p_data) {
      * or Technology F for ESE to resume SPI session for ESE-UICC concurrency */
     if (inpOutData->inp.data.nxpCmd.p_cmd[0] == 0xC0) {
       StateMachine::GetInstance().ProcessExtEvent(EVT_RF_ACT_NTF_ESE);
+      phPalEse_spi_publishAvailability(false);
       {
         SyncEventGuard guard(gSpiTxLock);
         ALOGD_IF(ese_debug_enabled, "%s: Notifying SPI_TX Wait if waiting...",
                  __FUNCTION__);
-        gSpiTxLock.notifyOne();
+        /* Drain all the transceives queued during RF, in order */
+        gSpiTxLock.notifyAll();
       }
     }
   } break;
+  case HAL_NFC_IOCTL_SPI_DWP_RELEASE_NTF: {
+    ALOGD_IF(ese_debug_enabled, "%s: DWP released by NFC HAL", __FUNCTION__);
+    phPalEse_spi_notifyDwpRelease();
+  } break;
+  case HAL_NFC_IOCTL_DWNLD_STATE_NTF: {
+    ALOGD_IF(ese_debug_enabled, "%s: download state changed", __FUNCTION__);
+    phPalEse_spi_notifyDwnldState();
+  } break;
   case HAL_ESE_IOCTL_OMAPI_RELEASE_ESE_SESSION: {
     std::vector<uint8_t> signature(inpOutData->inp.data.nxpCmd.p_cmd,
                                    inpOutData->inp.data.nxpCmd.p_cmd +
@@ -166,6 +200,7 @@ ESESTATUS phNxpEse_spiIoctl(uint64_t ioctlType, void* p_data) {
       ALOGD_IF(ese_debug_enabled, "****RELEASE SESSION:SIGNATURE MATCHED****");
       if (gMfcAppSessionCount)
         gMfcAppSessionCount--;
+      phPalEse_spi_publishSessions();
     } else {
       ALOGD_IF(ese_debug_enabled, "**RELEASE SESSION:SIGNATURE NOT MATCHED**");
     }
@@ -177,6 +212,7 @@ ESESTATUS phNxpEse_spiIoctl(uint64_t ioctlType, void* p_data) {
     if (!phPalEse_spi_match_app_signatures(signature)) {
       ALOGD_IF(ese_debug_enabled, "******GET SESSION:SIGNATURE MATCHED******");
       gMfcAppSessionCount++;
+      phPalEse_spi_publishSessions();
       if (rf_status) {
         ALOGD_IF(ese_debug_enabled, "**GET SESSION:SIGNATURE MATCHED RF ON**");
         status = ESESTATUS_NOT_ALLOWED;
@@ -209,6 +245,7 @@ ESESTATUS phNxpEse_spiIoctl(uint64_t ioctlType, void* p_data) {
 ESESTATUS phPalEse_spi_open_and_configure(pphPalEse_Config_t pConfig) {
   int nHandle;
   int retryCnt = 0, nfc_access_retryCnt = 0;
+  uint32_t dwpReleaseSeq = 0;
   int retval;
   ese_nxp_IoctlInOutData_t inpOutData;
   NfcAdaptation& pNfcAdapt = NfcAdaptation::GetInstance();
@@ -257,12 +294,16 @@ ESESTATUS phPalEse_spi_open_and_configure(pphPalEse_Config_t pConfig) {
 
 retry_nfc_access:
   omapi_status = ESESTATUS_FAILED;
+  dwpReleaseSeq = phPalEse_spi_getDwpReleaseSeq();
   retval = pNfcAdapt.HalIoctl(HAL_NFC_SPI_DWP_SYNC, &inpOutData);
   if (omapi_status != 0) {
     ALOGD_IF(ese_debug_enabled, "omapi_status return failed.");
     nfc_access_retryCnt++;
-    phPalEse_sleep(2000000);
-    if (nfc_access_retryCnt < 5) goto retry_nfc_access;
+    if (nfc_access_retryCnt < DWP_ACCESS_RETRY_CNT) {
+      /* Retry as soon as NFC HAL releases the DWP channel */
+      phPalEse_spi_waitDwpRelease(dwpReleaseSeq, DWP_ACCESS_WAIT_TIME);
+      goto retry_nfc_access;
+    }
     ALOGD_IF(ese_debug_enabled, "%s: Return Exception NFC in USE...",
              __FUNCTION__);
     return ESESTATUS_FAILED;
@@ -278,7 +319,7 @@ retry:
       retryCnt++;
       ALOGE("Retry open eSE driver, retry cnt : %d", retryCnt);
       if (retryCnt < MAX_RETRY_CNT) {
-        phPalEse_sleep(1000000);
+        phPalEse_sleep(OPEN_RETRY_DELAY);
         goto retry;
       }
     }
@@ -422,6 +463,7 @@ ESESTATUS phPalEse_spi_ioctl(phPalEse_ControlCode_t eControlCode,
     case phPalEse_e_SetJcopDwnldState:
       // ret = sendIoctlData(p, HAL_NFC_SET_DWNLD_STATUS, &inpOutData);
       ret = ESESTATUS_SUCCESS;
+      phPalEse_spi_notifyDwnldState();
       break;
 #endif
     default:
@@ -448,11 +490,14 @@ void phPalEse_spi_rf_off_timer_expired_cb(union sigval) {
   // just to be sure that we acquired dwp channel before allowing any activity
   // on SPI
   usleep(100);
+  phPalEse_spi_notifyDwpRelease();
+  phPalEse_spi_publishAvailability(false);
   {
     SyncEventGuard guard(gSpiTxLock);
     ALOGD_IF(ese_debug_enabled, "%s: Notifying SPI_TX Wait if waiting...",
              __FUNCTION__);
-    gSpiTxLock.notifyOne();
+    /* Drain all the transceives queued during RF, in order */
+    gSpiTxLock.notifyAll();
   }
   {
     SyncEventGuard guard(gSpiOpenLock);
@@ -462,6 +507,249 @@ void phPalEse_spi_rf_off_timer_expired_cb(union sigval) {
   }
 }
 
+/*******************************************************************************
+**
+** Function         phPalEse_spi_notifyDwpRelease
+**
+** Description      Wakes up the requests waiting for NFC HAL to release the
+**                  DWP channel
+**
+** Parameters       none
+**
+** Returns          none
+**
+*******************************************************************************/
+static void phPalEse_spi_notifyDwpRelease(void) {
+  SyncEventGuard guard(gDwpReleaseEvent);
+  gDwpReleaseSeq++;
+  gDwpReleaseEvent.notifyAll();
+}
+
+/*******************************************************************************
+**
+** Function         phPalEse_spi_getDwpReleaseSeq
+**
+** Description      Returns the count of DWP release events
+**
+** Parameters       none
+**
+** Returns          release event count
+**
+*******************************************************************************/
+uint32_t phPalEse_spi_getDwpReleaseSeq(void) {
+  SyncEventGuard guard(gDwpReleaseEvent);
+  return gDwpReleaseSeq;
+}
+
+/*******************************************************************************
+**
+** Function         phPalEse_spi_waitDwpRelease
+**
+** Description      Waits until a DWP release is reported after seq was read,
+**                  bounded by timeoutMs
+**
+** Parameters       seq       - value of phPalEse_spi_getDwpReleaseSeq
+**                  timeoutMs - max. wait time
+**
+** Returns          true if a release was reported
+**
+*******************************************************************************/
+bool phPalEse_spi_waitDwpRelease(uint32_t seq, unsigned long timeoutMs) {
+  bool released =
+      phPalEse_spi_waitSeq(gDwpReleaseEvent, gDwpReleaseSeq, seq, timeoutMs);
+  ALOGD_IF(ese_debug_enabled, "%s: DWP release %s", __FUNCTION__,
+           released ? "reported" : "timed out");
+  return released;
+}
+
+/*******************************************************************************
+**
+** Function         phPalEse_spi_notifyDwnldState
+**
+** Description      Wakes up the requests waiting for a NFCC FW or JCOP
+**                  download state change
+**
+** Parameters       none
+**
+** Returns          none
+**
+*******************************************************************************/
+static void phPalEse_spi_notifyDwnldState(void) {
+  SyncEventGuard guard(gDwnldStateEvent);
+  gDwnldStateSeq++;
+  gDwnldStateEvent.notifyAll();
+}
+
+/*******************************************************************************
+**
+** Function         phPalEse_spi_getDwnldStateSeq
+**
+** Description      Returns the count of download state change events
+**
+** Parameters       none
+**
+** Returns          state change event count
+**
+*******************************************************************************/
+uint32_t phPalEse_spi_getDwnldStateSeq(void) {
+  SyncEventGuard guard(gDwnldStateEvent);
+  return gDwnldStateSeq;
+}
+
+/*******************************************************************************
+**
+** Function         phPalEse_spi_waitDwnldState
+**
+** Description      Waits until a download state change is reported after seq
+**                  was read, bounded by timeoutMs
+**
+** Parameters       seq       - value of phPalEse_spi_getDwnldStateSeq
+**                  timeoutMs - max. wait time
+**
+** Returns          true if a state change was reported
+**
+*******************************************************************************/
+bool phPalEse_spi_waitDwnldState(uint32_t seq, unsigned long timeoutMs) {
+  return phPalEse_spi_waitSeq(gDwnldStateEvent, gDwnldStateSeq, seq,
+                              timeoutMs);
+}
+
+/*******************************************************************************
+**
+** Function         phPalEse_spi_publishAvailability
+**
+** Description      Reports the SPI availability for the given RF state.
+**
+** Parameters       rfBusy - SPI is suspended for active RF
+**
+** Returns          none
+**
+*******************************************************************************/
+static void phPalEse_spi_publishAvailability(bool rfBusy) {
+  phPalEse_spi_updateAvailability(false, rfBusy);
+}
+
+/*******************************************************************************
+**
+** Function         phPalEse_spi_publishSessions
+**
+** Description      Reports a change of the number of Felica app sessions,
+**                  the RF state last published is kept.
+**
+** Parameters       none
+**
+** Returns          none
+**
+*******************************************************************************/
+static void phPalEse_spi_publishSessions(void) {
+  phPalEse_spi_updateAvailability(true, false);
+}
+
+/*******************************************************************************
+**
+** Function         phPalEse_spi_updateAvailability
+**
+** Description      Reports the SPI availability to the registered callback
+**                  if it or the number of Felica app sessions changed. The
+**                  callback runs without the lock held.
+**
+** Parameters       keepRf - use the RF state last published
+**                  rfBusy - SPI is suspended for active RF, unless keepRf
+**
+** Returns          none
+**
+*******************************************************************************/
+static void phPalEse_spi_updateAvailability(bool keepRf, bool rfBusy) {
+  phNxpEse_SpiAvailabilityCb_t pCb = NULL;
+  uint8_t sessions = gMfcAppSessionCount;
+  phNxpEse_SpiAvailability_t state = ESE_SPI_AVAILABLE;
+
+  pthread_mutex_lock(&gSpiAvailLock);
+  if (keepRf) rfBusy = (gSpiAvailState != ESE_SPI_AVAILABLE);
+  if (rfBusy) state = sessions ? ESE_SPI_RF_BUSY_FELICA : ESE_SPI_RF_BUSY;
+  if ((state != gSpiAvailState) || (sessions != gSpiAvailSessions)) {
+    gSpiAvailState = state;
+    gSpiAvailSessions = sessions;
+    gSpiAvailNtfCount++;
+    pCb = gSpiAvailCb;
+  }
+  pthread_mutex_unlock(&gSpiAvailLock);
+  if (pCb != NULL) {
+    ALOGD_IF(ese_debug_enabled, "%s: state %d Felica sessions %u",
+             __FUNCTION__, state, sessions);
+    pCb(state, sessions);
+  }
+}
+
+/*******************************************************************************
+**
+** Function         phNxpEse_SetSpiAvailabilityCallback
+**
+** Description      Registers the SPI availability callback, NULL removes it
+**
+** Parameters       pCb - callback
+**
+** Returns          none
+**
+*******************************************************************************/
+void phNxpEse_SetSpiAvailabilityCallback(phNxpEse_SpiAvailabilityCb_t pCb) {
+  pthread_mutex_lock(&gSpiAvailLock);
+  gSpiAvailCb = pCb;
+  pthread_mutex_unlock(&gSpiAvailLock);
+}
+
+/*******************************************************************************
+**
+** Function         phNxpEse_GetSpiAvailability
+**
+** Description      Returns the last published SPI availability
+**
+** Parameters       pState          - availability
+**                  pFelicaSessions - open Felica app sessions
+**
+** Returns          number of availability changes published so far
+**
+*******************************************************************************/
+uint32_t phNxpEse_GetSpiAvailability(phNxpEse_SpiAvailability_t* pState,
+                                     uint8_t* pFelicaSessions) {
+  pthread_mutex_lock(&gSpiAvailLock);
+  if (pState != NULL) *pState = gSpiAvailState;
+  if (pFelicaSessions != NULL) *pFelicaSessions = gSpiAvailSessions;
+  uint32_t count = gSpiAvailNtfCount;
+  pthread_mutex_unlock(&gSpiAvailLock);
+  return count;
+}
+
+/*******************************************************************************
+**
+** Function         phPalEse_spi_waitSeq
+**
+** Description      Waits on event until curSeq moves away from seq, bounded
+**                  by timeoutMs
+**
+** Parameters       event     - event guarding curSeq
+**                  curSeq    - event counter
+**                  seq       - counter value read before the wait
+**                  timeoutMs - max. wait time
+**
+** Returns          true if the counter moved
+**
+*******************************************************************************/
+static bool phPalEse_spi_waitSeq(SyncEvent& event, const uint32_t& curSeq,
+                                 uint32_t seq, unsigned long timeoutMs) {
+  struct timespec ts;
+  SyncEventGuard guard(event);
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t now = ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+  uint64_t deadline = now + timeoutMs;
+  while ((curSeq == seq) && (now < deadline)) {
+    event.wait(deadline - now);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+  }
+  return (curSeq != seq);
+}
+
 /*******************************************************************************
 **
 ** Function         phPalEse_spi_start_debounce_timer
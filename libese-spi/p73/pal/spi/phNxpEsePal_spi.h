@@ -27,6 +27,7 @@
 #include <IntervalTimer.h>
 #include <StateMachineInfo.h>
 #include <phNxpEsePal.h>
+#include <vector>
 
 /*!
  * \brief Start of frame marker
@@ -207,5 +208,63 @@ void phPalEse_spi_rf_off_timer_expired_cb(union sigval);
 *******************************************************************************/
 ESESTATUS phPalEse_spi_match_app_signatures(std::vector<uint8_t> signature);
 
+/*******************************************************************************
+**
+** Function         phPalEse_spi_getDwpReleaseSeq
+**
+** Description      Returns the count of DWP release events, to be read before
+**                  requesting DWP access from NFC HAL
+**
+** Parameters       none
+**
+** Returns          release event count
+**
+*******************************************************************************/
+uint32_t phPalEse_spi_getDwpReleaseSeq(void);
+
+/*******************************************************************************
+**
+** Function         phPalEse_spi_waitDwpRelease
+**
+** Description      Waits until NFC HAL reports a DWP release after seq was
+**                  read, or timeoutMs elapsed
+**
+** Parameters       seq       - value of phPalEse_spi_getDwpReleaseSeq
+**                  timeoutMs - max. wait time
+**
+** Returns          true if a release was reported
+**
+*******************************************************************************/
+bool phPalEse_spi_waitDwpRelease(uint32_t seq, unsigned long timeoutMs);
+
+/*******************************************************************************
+**
+** Function         phPalEse_spi_getDwnldStateSeq
+**
+** Description      Returns the count of NFCC FW / JCOP download state change
+**                  events, to be read before checking the SPM state
+**
+** Parameters       none
+**
+** Returns          state change event count
+**
+*******************************************************************************/
+uint32_t phPalEse_spi_getDwnldStateSeq(void);
+
+/*******************************************************************************
+**
+** Function         phPalEse_spi_waitDwnldState
+**
+** Description      Waits until NFC HAL reports a download state change after
+**                  seq was read, or timeoutMs elapsed
+**
+** Parameters       seq       - value of phPalEse_spi_getDwnldStateSeq
+**                  timeoutMs - max. wait time
+**
+** Returns          true if a state change was reported
+**
+*******************************************************************************/
+bool phPalEse_spi_waitDwnldState(uint32_t seq, unsigned long timeoutMs);
+
 /** @} */
 #endif /*  _PHNXPESE_PAL_SPI_H    */
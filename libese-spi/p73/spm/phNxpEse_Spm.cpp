@@ -21,7 +21,10 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <phNxpEsePal.h>
+#include <phNxpEsePal_spi.h>
+#include <phNxpEseProto7816_3.h>
 #include <phNxpEse_Internal.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -44,6 +47,30 @@ static ESESTATUS phNxpEse_secureTimerStart(unsigned long timeInMilliSec);
 static IntervalTimer &getSecureTimerInstance();
 /* Dummy handle for ioctl call in case secure timer expired*/
 #define SECURE_TIMER_MAGIC_HANDLE 0xFF
+#define SPM_PWR_UNKNOWN -1
+
+/* User-space mirror of the driver side SPM state. The state read is reused
+ * until it is invalidated by a state changing request or a NFC HAL
+ * notification (download state / DWP release); the power request and scheme
+ * are remembered so that repeating them does not reach the driver. */
+static pthread_mutex_t gsSpmMirrorLock = PTHREAD_MUTEX_INITIALIZER;
+static bool gsSpmStateValid = false;
+static spm_state_t gsSpmState = SPM_STATE_INVALID;
+static uint32_t gsSpmDwnldSeq = 0;
+static uint32_t gsSpmDwpSeq = 0;
+static int gsSpmPwrApplied = SPM_PWR_UNKNOWN;
+static long gsSpmPwrScheme = SPM_PWR_UNKNOWN;
+static phNxpEse_SpmStats_t gsSpmStats;
+/* Power accounting, 0 when the eSE is off / nothing was powered yet */
+static uint64_t gsSpmPwrOnSince = 0;
+static uint64_t gsSpmStatsSince = 0;
+static int32_t phNxpEse_SPM_ioctl(phPalEse_ControlCode_t eControlCode,
+                                  void* pDevHandle, long level);
+static int32_t phNxpEse_SPM_ioctlLocked(phPalEse_ControlCode_t eControlCode,
+                                        void* pDevHandle, long level);
+static void phNxpEse_SPM_ioctlDone(int32_t ret);
+static bool phNxpEse_SPM_mirrorFresh(void);
+static void phNxpEse_SPM_trackPower(long arg);
 
 /**
  * \addtogroup SPI_Power_Management
@@ -68,6 +95,8 @@ static IntervalTimer &getSecureTimerInstance();
 ESESTATUS phNxpEse_SPM_Init(void* pDevHandle) {
   ESESTATUS status = ESESTATUS_SUCCESS;
   pEseDeviceHandle = pDevHandle;
+  /*State may have changed while no session was open*/
+  phNxpEse_SPM_InvalidateState();
   if (NULL == pEseDeviceHandle) {
     ALOGE("%s : failed, device handle is null", __FUNCTION__);
     status = ESESTATUS_FAILED;
@@ -113,10 +142,29 @@ ESESTATUS phNxpEse_SPM_ConfigPwr(spm_power_t arg) {
            __FUNCTION__, nxpese_ctxt.secureTimerParams.secureTimer1,
            nxpese_ctxt.secureTimerParams.secureTimer2,
            nxpese_ctxt.secureTimerParams.secureTimer3);
-  gsCurIoctlRequest = arg;
   phNxpEse_GetMaxTimer(&timeInMilliSec);
-  if (timeInMilliSec != 0 &&
-      (arg == SPM_POWER_DISABLE || arg == SPM_POWER_RESET)) {
+  bool deferred = (timeInMilliSec != 0) &&
+                  (arg == SPM_POWER_DISABLE || arg == SPM_POWER_RESET);
+  /*The applied power request and the driver must not disagree, the secure
+   * timer may fire concurrently*/
+  pthread_mutex_lock(&gsSpmMirrorLock);
+  gsCurIoctlRequest = arg;
+  if ((arg == SPM_POWER_ENABLE) && phNxpEse_SPM_mirrorFresh() &&
+      (gsSpmPwrApplied == SPM_POWER_ENABLE)) {
+    /*A deferred disable was cancelled before reaching the driver, so the
+     * power is still on*/
+    ALOGD_IF(ese_debug_enabled, "%s power already enabled", __FUNCTION__);
+    gsSpmStats.skippedCount++;
+    ret = 0;
+  } else if (!deferred) {
+    ret = phNxpEse_SPM_ioctlLocked(phPalEse_e_ChipRst, pEseDeviceHandle, arg);
+    if (ret >= 0) {
+      gsSpmPwrApplied = arg;
+      phNxpEse_SPM_trackPower(arg);
+    }
+  }
+  pthread_mutex_unlock(&gsSpmMirrorLock);
+  if (deferred) {
     wSpmStatus = phNxpEse_secureTimerStart(timeInMilliSec);
     if (wSpmStatus != ESESTATUS_SUCCESS) {
       ALOGE("%s phNxpEse_secureTimerStart: failed", __FUNCTION__);
@@ -125,9 +173,12 @@ ESESTATUS phNxpEse_SPM_ConfigPwr(spm_power_t arg) {
       wSpmStatus = ESESTATUS_SUCCESS;
       ret = 0;
     }
-  } else {
-    ret = phPalEse_ioctl(phPalEse_e_ChipRst, pEseDeviceHandle, arg);
+  } else if ((arg == SPM_POWER_DISABLE) || (arg == SPM_POWER_RESET) ||
+             (ret < 0)) {
+    /*eSE power cycled or in an unknown state, the next open is cold*/
+    phNxpEseProto7816_MarkCold();
   }
+  phNxpEse_SPM_InvalidateState();
   switch (arg) {
     case SPM_POWER_DISABLE: {
       if (ret < 0) {
@@ -223,7 +274,12 @@ ESESTATUS phNxpEse_SPM_EnablePwr(void) {
   spm_state_t current_spm_state = SPM_STATE_INVALID;
   ALOGD_IF(ese_debug_enabled, "%s : phNxpEse_SPM_EnablePwr is set to  = 0x%d",
            __FUNCTION__, 0);
-  ret = phPalEse_ioctl(phPalEse_e_ChipRst, pEseDeviceHandle, 0);
+  pthread_mutex_lock(&gsSpmMirrorLock);
+  ret = phNxpEse_SPM_ioctlLocked(phPalEse_e_ChipRst, pEseDeviceHandle, 0);
+  gsSpmPwrApplied = SPM_PWR_UNKNOWN;
+  pthread_mutex_unlock(&gsSpmMirrorLock);
+  phNxpEseProto7816_MarkCold();
+  phNxpEse_SPM_InvalidateState();
   if (ret < 0) {
     ALOGE("%s : failed errno = 0x%x", __FUNCTION__, errno);
     if (errno == -EBUSY) {
@@ -262,7 +318,12 @@ ESESTATUS phNxpEse_SPM_DisablePwr(void) {
   ESESTATUS status = ESESTATUS_SUCCESS;
   ALOGD_IF(ese_debug_enabled, "%s : phNxpEse_SPM_DisablePwr is set to  = 0x%d",
            __FUNCTION__, 1);
-  ret = phPalEse_ioctl(phPalEse_e_ChipRst, pEseDeviceHandle, 1);
+  pthread_mutex_lock(&gsSpmMirrorLock);
+  ret = phNxpEse_SPM_ioctlLocked(phPalEse_e_ChipRst, pEseDeviceHandle, 1);
+  gsSpmPwrApplied = SPM_PWR_UNKNOWN;
+  pthread_mutex_unlock(&gsSpmMirrorLock);
+  phNxpEseProto7816_MarkCold();
+  phNxpEse_SPM_InvalidateState();
   if (ret < 0) {
     ALOGE("%s : failed errno = 0x%x", __FUNCTION__, errno);
     status = ESESTATUS_FAILED;
@@ -285,10 +346,22 @@ ESESTATUS phNxpEse_SPM_SetPwrScheme(long arg) {
 
   ALOGD_IF(ese_debug_enabled, "%s : Power scheme is set to  = 0x%ld",
            __FUNCTION__, arg);
-  ret = phPalEse_ioctl(phPalEse_e_SetPowerScheme, pEseDeviceHandle, arg);
+  /*The driver keeps the scheme across sessions*/
+  pthread_mutex_lock(&gsSpmMirrorLock);
+  if (gsSpmPwrScheme == arg) {
+    gsSpmStats.skippedCount++;
+    pthread_mutex_unlock(&gsSpmMirrorLock);
+    return status;
+  }
+  pthread_mutex_unlock(&gsSpmMirrorLock);
+  ret = phNxpEse_SPM_ioctl(phPalEse_e_SetPowerScheme, pEseDeviceHandle, arg);
   if (ret < 0) {
     ALOGE("%s : failed errno = 0x%x", __FUNCTION__, errno);
     status = ESESTATUS_FAILED;
+  } else {
+    pthread_mutex_lock(&gsSpmMirrorLock);
+    gsSpmPwrScheme = arg;
+    pthread_mutex_unlock(&gsSpmMirrorLock);
   }
 
   return status;
@@ -309,7 +382,12 @@ ESESTATUS phNxpEse_SPM_DisablePwrControl(unsigned long arg) {
 
   ALOGD_IF(ese_debug_enabled, "%s : Inhibit power control is set to  = 0x%ld",
            __FUNCTION__, arg);
-  ret = phPalEse_ioctl(phPalEse_e_ChipRst, pEseDeviceHandle, arg);
+  pthread_mutex_lock(&gsSpmMirrorLock);
+  ret = phNxpEse_SPM_ioctlLocked(phPalEse_e_ChipRst, pEseDeviceHandle, arg);
+  gsSpmPwrApplied = SPM_PWR_UNKNOWN;
+  pthread_mutex_unlock(&gsSpmMirrorLock);
+  phNxpEseProto7816_MarkCold();
+  phNxpEse_SPM_InvalidateState();
   if (ret < 0) {
     ALOGE("%s : failed errno = 0x%x", __FUNCTION__, errno);
     status = ESESTATUS_FAILED;
@@ -335,13 +413,29 @@ ESESTATUS phNxpEse_SPM_GetState(spm_state_t* current_state) {
     ALOGE("%s : failed Invalid argument", __FUNCTION__);
     return ESESTATUS_FAILED;
   }
-  ret = phPalEse_ioctl(phPalEse_e_GetSPMStatus, pEseDeviceHandle,
-                       (unsigned long)&ese_current_state);
+  pthread_mutex_lock(&gsSpmMirrorLock);
+  if (phNxpEse_SPM_mirrorFresh() && gsSpmStateValid) {
+    *current_state = gsSpmState;
+    gsSpmStats.skippedCount++;
+    pthread_mutex_unlock(&gsSpmMirrorLock);
+    return status;
+  }
+  pthread_mutex_unlock(&gsSpmMirrorLock);
+  uint32_t dwnldSeq = phPalEse_spi_getDwnldStateSeq();
+  uint32_t dwpSeq = phPalEse_spi_getDwpReleaseSeq();
+  ret = phNxpEse_SPM_ioctl(phPalEse_e_GetSPMStatus, pEseDeviceHandle,
+                           (unsigned long)&ese_current_state);
   if (ret < 0) {
     ALOGE("%s : failed errno = 0x%x", __FUNCTION__, errno);
     status = ESESTATUS_FAILED;
   } else {
     *current_state = ese_current_state; /* Current ESE state */
+    pthread_mutex_lock(&gsSpmMirrorLock);
+    gsSpmState = ese_current_state;
+    gsSpmDwnldSeq = dwnldSeq;
+    gsSpmDwpSeq = dwpSeq;
+    gsSpmStateValid = true;
+    pthread_mutex_unlock(&gsSpmMirrorLock);
   }
 
   return status;
@@ -361,7 +455,9 @@ ESESTATUS phNxpEse_SPM_SetJcopDwnldState(long arg) {
 
   ALOGD_IF(ese_debug_enabled, "%s :phNxpEse_SPM_SetJcopDwnldState  = 0x%ld",
            __FUNCTION__, arg);
-  ret = phPalEse_ioctl(phPalEse_e_SetJcopDwnldState, pEseDeviceHandle, arg);
+  ret = phNxpEse_SPM_ioctl(phPalEse_e_SetJcopDwnldState, pEseDeviceHandle,
+                           arg);
+  phNxpEse_SPM_InvalidateState();
   if (ret < 0) {
     ALOGE("%s : failed errno = 0x%x", __FUNCTION__, errno);
     status = ESESTATUS_FAILED;
@@ -396,10 +492,19 @@ static IntervalTimer &getSecureTimerInstance() {
 static void phNxpEse_secureTimerExpired(union sigval) {
   int32_t ret = -1;
   ALOGD_IF(ese_debug_enabled, "phNxpEse_secureTimerExpired callback triggered");
-  if (gsCurIoctlRequest == SPM_POWER_DISABLE) {
-    ret = phPalEse_ioctl(phPalEse_e_ChipRst,
-                         (void *)((intptr_t)SECURE_TIMER_MAGIC_HANDLE),
-                         gsCurIoctlRequest);
+  pthread_mutex_lock(&gsSpmMirrorLock);
+  bool disable = (gsCurIoctlRequest == SPM_POWER_DISABLE);
+  if (disable) {
+    ret = phNxpEse_SPM_ioctlLocked(
+        phPalEse_e_ChipRst, (void*)((intptr_t)SECURE_TIMER_MAGIC_HANDLE),
+        SPM_POWER_DISABLE);
+    gsSpmPwrApplied = (ret >= 0) ? SPM_POWER_DISABLE : SPM_PWR_UNKNOWN;
+    if (ret >= 0) phNxpEse_SPM_trackPower(SPM_POWER_DISABLE);
+  }
+  pthread_mutex_unlock(&gsSpmMirrorLock);
+  if (disable) {
+    phNxpEseProto7816_MarkCold();
+    phNxpEse_SPM_InvalidateState();
   }
   getSecureTimerInstance().kill();
 }
@@ -448,3 +553,140 @@ void phNxpEse_secureTimerStop() {
   ALOGD_IF(ese_debug_enabled, "Stopping Secure timer...");
   getSecureTimerInstance().kill();
 }
+
+/******************************************************************************
+ * Function         phNxpEse_SPM_InvalidateState
+ *
+ * Description      This function drops the mirrored SPM state so that the
+ *                  next phNxpEse_SPM_GetState reads it from the driver
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+void phNxpEse_SPM_InvalidateState(void) {
+  pthread_mutex_lock(&gsSpmMirrorLock);
+  gsSpmStateValid = false;
+  pthread_mutex_unlock(&gsSpmMirrorLock);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_SPM_GetStats
+ *
+ * Description      This function returns the driver call statistics
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+void phNxpEse_SPM_GetStats(phNxpEse_SpmStats_t* pStats) {
+  if (pStats == NULL) return;
+  uint64_t now = phNxpEse_getTimeMs();
+  pthread_mutex_lock(&gsSpmMirrorLock);
+  *pStats = gsSpmStats;
+  /* Include the power window in progress */
+  if (gsSpmPwrOnSince != 0) pStats->pwrOnTimeMs += now - gsSpmPwrOnSince;
+  pStats->elapsedMs = (gsSpmStatsSince != 0) ? (now - gsSpmStatsSince) : 0;
+  pthread_mutex_unlock(&gsSpmMirrorLock);
+}
+
+/******************************************************************************
+ * Function         phNxpEse_SPM_trackPower
+ *
+ * Description      This function accounts a power request accepted by the
+ *                  driver: a power-up while off starts a power cycle, a
+ *                  power-down ends it and adds its duration to the on-time.
+ *                  Called with gsSpmMirrorLock held.
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+static void phNxpEse_SPM_trackPower(long arg) {
+  uint64_t now = phNxpEse_getTimeMs();
+  if ((arg == SPM_POWER_ENABLE) && (gsSpmPwrOnSince == 0)) {
+    gsSpmPwrOnSince = now;
+    if (gsSpmStatsSince == 0) gsSpmStatsSince = now;
+    gsSpmStats.pwrCycleCount++;
+  } else if ((arg == SPM_POWER_DISABLE) && (gsSpmPwrOnSince != 0)) {
+    gsSpmStats.pwrOnTimeMs += now - gsSpmPwrOnSince;
+    gsSpmPwrOnSince = 0;
+  }
+}
+
+/******************************************************************************
+ * Function         phNxpEse_SPM_mirrorFresh
+ *
+ * Description      This function checks that NFC HAL reported no download
+ *                  state change nor DWP release since the state was mirrored.
+ *                  A stale mirror is dropped, including the applied power
+ *                  request as NFC HAL may have power cycled the eSE.
+ *                  Called with gsSpmMirrorLock held.
+ *
+ * Returns          true if the mirror can be used
+ *
+ ******************************************************************************/
+static bool phNxpEse_SPM_mirrorFresh(void) {
+  uint32_t dwnldSeq = phPalEse_spi_getDwnldStateSeq();
+  uint32_t dwpSeq = phPalEse_spi_getDwpReleaseSeq();
+  bool fresh = true;
+  if ((dwnldSeq != gsSpmDwnldSeq) || (dwpSeq != gsSpmDwpSeq)) {
+    gsSpmStateValid = false;
+    if (dwnldSeq != gsSpmDwnldSeq) gsSpmPwrApplied = SPM_PWR_UNKNOWN;
+    gsSpmDwnldSeq = dwnldSeq;
+    gsSpmDwpSeq = dwpSeq;
+    fresh = false;
+  }
+  return fresh;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_SPM_ioctl
+ *
+ * Description      This function forwards a request to the driver and keeps
+ *                  count of the driver calls. A failed request leaves the
+ *                  driver state unknown, so the mirror is dropped.
+ *
+ * Returns          driver return value
+ *
+ ******************************************************************************/
+static int32_t phNxpEse_SPM_ioctl(phPalEse_ControlCode_t eControlCode,
+                                  void* pDevHandle, long level) {
+  int32_t ret = phPalEse_ioctl(eControlCode, pDevHandle, level);
+  pthread_mutex_lock(&gsSpmMirrorLock);
+  phNxpEse_SPM_ioctlDone(ret);
+  pthread_mutex_unlock(&gsSpmMirrorLock);
+  return ret;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_SPM_ioctlLocked
+ *
+ * Description      This function is phNxpEse_SPM_ioctl for callers holding
+ *                  gsSpmMirrorLock, so that the request and the mirror of
+ *                  its outcome cannot be interleaved with another request
+ *
+ * Returns          driver return value
+ *
+ ******************************************************************************/
+static int32_t phNxpEse_SPM_ioctlLocked(phPalEse_ControlCode_t eControlCode,
+                                        void* pDevHandle, long level) {
+  int32_t ret = phPalEse_ioctl(eControlCode, pDevHandle, level);
+  phNxpEse_SPM_ioctlDone(ret);
+  return ret;
+}
+
+/******************************************************************************
+ * Function         phNxpEse_SPM_ioctlDone
+ *
+ * Description      This function accounts a driver call. Called with
+ *                  gsSpmMirrorLock held.
+ *
+ * Returns          None
+ *
+ ******************************************************************************/
+static void phNxpEse_SPM_ioctlDone(int32_t ret) {
+  gsSpmStats.ioctlCount++;
+  if (ret < 0) {
+    gsSpmStateValid = false;
+    gsSpmPwrApplied = SPM_PWR_UNKNOWN;
+    gsSpmPwrScheme = SPM_PWR_UNKNOWN;
+  }
+}
@@ -50,6 +50,15 @@ typedef enum spm_state {
 #endif
 } spm_state_t;
 
+/*! SPM driver call statistics */
+typedef struct phNxpEse_SpmStats {
+  uint32_t ioctlCount;   /*!< requests forwarded to the driver */
+  uint32_t skippedCount; /*!< requests served from the user-space mirror */
+  uint32_t pwrCycleCount; /*!< eSE power-ups issued to the driver */
+  uint64_t pwrOnTimeMs;   /*!< time the eSE was powered, in ms */
+  uint64_t elapsedMs;     /*!< time since the first power-up, in ms */
+} phNxpEse_SpmStats_t;
+
 ESESTATUS phNxpEse_SPM_Init(void* pDevHandle);
 
 ESESTATUS phNxpEse_SPM_DeInit(void);
@@ -71,6 +80,10 @@ ESESTATUS phNxpEse_SPM_RelAccess(void);
 ESESTATUS phNxpEse_SPM_SetPwrScheme(long arg);
 
 ESESTATUS phNxpEse_SPM_DisablePwrControl(unsigned long arg);
+
+void phNxpEse_SPM_InvalidateState(void);
+
+void phNxpEse_SPM_GetStats(phNxpEse_SpmStats_t* pStats);
 #ifdef NXP_ESE_JCOP_DWNLD_PROTECTION
 ESESTATUS phNxpEse_SPM_SetJcopDwnldState(long arg);
 #endif
@@ -0,0 +1,135 @@
+/******************************************************************************
+ *
+ *  Copyright 2018 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+#define LOG_TAG "NxpEseBootTrace"
+#include "ese_boot_trace.h"
+
+#include <cutils/properties.h>
+#include <log/log.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+  const char* step;
+  uint64_t beginMs;
+  uint64_t endMs;
+} EseBootStep_t;
+
+static pthread_mutex_t gsBootTraceLock = PTHREAD_MUTEX_INITIALIZER;
+static EseBootStep_t gsBootSteps[ESE_BOOT_TRACE_MAX_STEPS];
+static uint8_t gsBootStepCount = 0;
+static bool gsBootTracePublished = false;
+
+/*******************************************************************************
+**
+** Function         eseBootTrace_nowMs
+**
+** Description      Time since kernel boot, including suspend, so that the
+**                  timeline can be lined up with the rest of the boot
+**
+** Returns          Milliseconds since boot
+**
+*******************************************************************************/
+static uint64_t eseBootTrace_nowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_BOOTTIME, &ts);
+  return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/*******************************************************************************
+**
+** Function         eseBootTrace_begin
+**
+** Description      Records the start of a startup step
+**
+** Returns          None
+**
+*******************************************************************************/
+void eseBootTrace_begin(const char* step) {
+  uint64_t now = eseBootTrace_nowMs();
+  pthread_mutex_lock(&gsBootTraceLock);
+  if (!gsBootTracePublished && gsBootStepCount < ESE_BOOT_TRACE_MAX_STEPS) {
+    gsBootSteps[gsBootStepCount].step = step;
+    gsBootSteps[gsBootStepCount].beginMs = now;
+    gsBootSteps[gsBootStepCount].endMs = 0;
+    gsBootStepCount++;
+  }
+  pthread_mutex_unlock(&gsBootTraceLock);
+}
+
+/*******************************************************************************
+**
+** Function         eseBootTrace_end
+**
+** Description      Records the end of the latest open instance of a step
+**
+** Returns          None
+**
+*******************************************************************************/
+void eseBootTrace_end(const char* step) {
+  uint64_t now = eseBootTrace_nowMs();
+  pthread_mutex_lock(&gsBootTraceLock);
+  for (int i = gsBootStepCount - 1; i >= 0; i--) {
+    if (gsBootSteps[i].endMs == 0 && strcmp(gsBootSteps[i].step, step) == 0) {
+      gsBootSteps[i].endMs = now;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&gsBootTraceLock);
+}
+
+/*******************************************************************************
+**
+** Function         eseBootTrace_publish
+**
+** Description      Dumps the startup timeline once the eSE is ready and
+**                  exports the ready time as a system property
+**
+** Returns          None
+**
+*******************************************************************************/
+void eseBootTrace_publish(void) {
+  uint64_t now = eseBootTrace_nowMs();
+  char value[PROPERTY_VALUE_MAX];
+
+  pthread_mutex_lock(&gsBootTraceLock);
+  if (gsBootTracePublished) {
+    pthread_mutex_unlock(&gsBootTraceLock);
+    return;
+  }
+  gsBootTracePublished = true;
+  uint64_t originMs = (gsBootStepCount > 0) ? gsBootSteps[0].beginMs : now;
+  for (uint8_t i = 0; i < gsBootStepCount; i++) {
+    if (gsBootSteps[i].endMs == 0) {
+      ALOGD("startup %-16s +%llums still running", gsBootSteps[i].step,
+            (unsigned long long)(gsBootSteps[i].beginMs - originMs));
+    } else {
+      ALOGD("startup %-16s +%llums took %llums", gsBootSteps[i].step,
+            (unsigned long long)(gsBootSteps[i].beginMs - originMs),
+            (unsigned long long)(gsBootSteps[i].endMs -
+                                 gsBootSteps[i].beginMs));
+    }
+  }
+  pthread_mutex_unlock(&gsBootTraceLock);
+
+  ALOGD("startup eSE ready %llums after service start (boot +%llums)",
+        (unsigned long long)(now - originMs), (unsigned long long)now);
+  snprintf(value, sizeof(value), "%llu", (unsigned long long)now);
+  property_set(ESE_BOOT_TRACE_READY_PROP, value);
+}
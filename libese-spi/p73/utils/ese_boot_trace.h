@@ -0,0 +1,39 @@
+/******************************************************************************
+ *
+ *  Copyright 2018 NXP
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+/* Maximum number of steps recorded in the startup timeline */
+#define ESE_BOOT_TRACE_MAX_STEPS 16
+
+/* Property carrying the CLOCK_BOOTTIME (ms) at which the eSE became ready */
+#define ESE_BOOT_TRACE_READY_PROP "vendor.ese.boot_ready_ms"
+
+// Records the start of startup step |step|. |step| must be a string literal.
+// Steps may run concurrently on different threads.
+void eseBootTrace_begin(const char* step);
+
+// Records the end of startup step |step|, started with |eseBootTrace_begin|.
+void eseBootTrace_end(const char* step);
+
+// Logs the startup timeline with per-step start offsets and durations and
+// exports the ready time through ESE_BOOT_TRACE_READY_PROP. Only the first
+// call after service start has any effect.
+void eseBootTrace_publish(void);
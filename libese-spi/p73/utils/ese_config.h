@@ -32,6 +32,8 @@
 #define NAME_NXP_SOF_WRITE "NXP_SOF_WRITE"
 #define NAME_NXP_TP_MEASUREMENT "NXP_TP_MEASUREMENT"
 #define NAME_NXP_SPI_INTF_RST_ENABLE "NXP_SPI_INTF_RST_ENABLE"
+#define NAME_NXP_SPI_WARM_OPEN "NXP_SPI_WARM_OPEN"
+#define NAME_NXP_RECOVERY_POLICY "NXP_RECOVERY_POLICY"
 #define NAME_NXP_MAX_RNACK_RETRY "NXP_MAX_RNACK_RETRY"
 #define NAME_NXP_SPI_WRITE_TIMEOUT "NXP_SPI_WRITE_TIMEOUT"
 #define NAME_NXP_ESE_DEV_NODE "NXP_ESE_DEV_NODE"
@@ -42,6 +44,14 @@
 #define NAME_NXP_OMAPI_APP_SIGNATURE_4 "NXP_OMAPI_APP_SIGNATURE_4"
 #define NAME_NXP_OMAPI_APP_SIGNATURE_5 "NXP_OMAPI_APP_SIGNATURE_5"
 #define NAME_NXP_OMAPI_APP_TIMEOUT "NXP_OMAPI_APP_TIMEOUT"
+#define NAME_NXP_LS_DUTY_CYCLE "NXP_LS_DUTY_CYCLE"
+#define NAME_NXP_LS_MAX_YIELD_TIME "NXP_LS_MAX_YIELD_TIME"
+#define NAME_NXP_PRIO_MAX_WAIT_TIME "NXP_PRIO_MAX_WAIT_TIME"
+#define NAME_NXP_AUTO_GET_RESPONSE "NXP_AUTO_GET_RESPONSE"
+#define NAME_NXP_AUTO_GET_RESPONSE_MAX_LEN "NXP_AUTO_GET_RESPONSE_MAX_LEN"
+#define NAME_NXP_LOGICAL_CHANNEL_POOL_SIZE "NXP_LOGICAL_CHANNEL_POOL_SIZE"
+#define NAME_NXP_SELECT_CACHE_TTL "NXP_SELECT_CACHE_TTL"
+#define NAME_NXP_SE_TRANSMIT_TIMEOUT "NXP_SE_TRANSMIT_TIMEOUT"
 
 class EseConfig {
  public:
@@ -30,6 +30,8 @@ using android::hardware::hidl_vec;
 using vendor::nxp::nxpnfc::V1_0::INxpNfc;
 
 Mutex NfcAdaptation::sLock;
+SyncEvent NfcAdaptation::sInitLock;
+bool NfcAdaptation::sLookupActive = false;
 Mutex NfcAdaptation::sIoctlLock;
 
 sp<INxpNfc> NfcAdaptation::mHalNxpNfc = nullptr;
@@ -42,21 +44,37 @@ extern bool ese_debug_enabled;
 **
 ** Function:    NfcAdaptation::Initialize()
 **
-** Description: Tries to get reference to Hw service
+** Description: Tries to get reference to Hw service, blocking until it is
+**              registered if waitForService is set. A caller racing with
+**              a lookup already in progress waits for its result.
+**              The lookup runs without sInitLock, only its result is
+**              published under it.
 **
 ** Returns:     none
 **
 *******************************************************************************/
-void NfcAdaptation::Initialize() {
+void NfcAdaptation::Initialize(bool waitForService) {
   const char* func = "NfcAdaptation::Initialize";
   ALOGD_IF(ese_debug_enabled, "%s", func);
-  if (mHalNxpNfc != nullptr) return;
-  mHalNxpNfc = INxpNfc::tryGetService();
-  LOG_FATAL_IF(mHalNxpNfc == nullptr, "Failed to retrieve the NXP NFC HAL!");
-  if (mHalNxpNfc != nullptr) {
+  {
+    SyncEventGuard guard(sInitLock);
+    while (sLookupActive) sInitLock.wait();
+    if (mHalNxpNfc != nullptr) return;
+    sLookupActive = true;
+  }
+  sp<INxpNfc> halNxpNfc =
+      waitForService ? INxpNfc::getService() : INxpNfc::tryGetService();
+  LOG_FATAL_IF(halNxpNfc == nullptr, "Failed to retrieve the NXP NFC HAL!");
+  if (halNxpNfc != nullptr) {
     ALOGD_IF(ese_debug_enabled, "%s: INxpNfc::getService() returned %p (%s)",
-             func, mHalNxpNfc.get(),
-             (mHalNxpNfc->isRemote() ? "remote" : "local"));
+             func, halNxpNfc.get(),
+             (halNxpNfc->isRemote() ? "remote" : "local"));
+  }
+  {
+    SyncEventGuard guard(sInitLock);
+    mHalNxpNfc = halNxpNfc;
+    sLookupActive = false;
+    sInitLock.notifyAll();
   }
   ALOGD_IF(ese_debug_enabled, "%s: exit", func);
 }
@@ -152,8 +170,13 @@ ESESTATUS NfcAdaptation::HalIoctl(long arg, void* p_data) {
   pInpOutData->inp.context = &NfcAdaptation::GetInstance();
   NfcAdaptation::GetInstance().mCurrentIoctlData = pInpOutData;
   data.setToExternal((uint8_t*)pInpOutData, sizeof(ese_nxp_IoctlInOutData_t));
-  if (mHalNxpNfc != nullptr) {
-    mHalNxpNfc->ioctl(arg, data, IoctlCallback);
+  sp<INxpNfc> halNxpNfc;
+  {
+    SyncEventGuard guard(sInitLock);
+    halNxpNfc = mHalNxpNfc;
+  }
+  if (halNxpNfc != nullptr) {
+    halNxpNfc->ioctl(arg, data, IoctlCallback);
   }
   ALOGD_IF(ese_debug_enabled, "%s Ioctl Completed for Type=%lu", func,
            (unsigned long)pInpOutData->out.ioctlType);
@@ -80,6 +80,17 @@ public:
   *******************************************************************************/
   void notifyOne();
 
+  /*******************************************************************************
+  **
+  ** Function:        notifyAll
+  **
+  ** Description:     Unblock all the waiting threads.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void notifyAll();
+
 private:
   pthread_cond_t mCondition;
 };
@@ -30,7 +30,7 @@ using vendor::nxp::nxpnfc::V1_0::INxpNfc;
 class NfcAdaptation {
  public:
    ~NfcAdaptation();
-   void Initialize();
+   void Initialize(bool waitForService = false);
    static NfcAdaptation &GetInstance();
    static ESESTATUS HalIoctl(long data_len, void *p_data);
    ese_nxp_IoctlInOutData_t *mCurrentIoctlData;
@@ -38,6 +38,8 @@ class NfcAdaptation {
  private:
   NfcAdaptation();
   static Mutex sLock;
+  static SyncEvent sInitLock;
+  static bool sLookupActive;
   static Mutex sIoctlLock;
   static NfcAdaptation* mpInstance;
   static android::sp<INxpNfc> mHalNxpNfc;
@@ -83,6 +83,17 @@ public:
   *******************************************************************************/
   void notifyOne() { mCondVar.notifyOne(); }
 
+  /*******************************************************************************
+  **
+  ** Function:        notifyAll
+  **
+  ** Description:     Notify all the blocked threads that the event has occured.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void notifyAll() { mCondVar.notifyAll(); }
+
   /*******************************************************************************
   **
   ** Function:        end
@@ -28,9 +28,13 @@
 #include "StateMachine.h"
 
 #define HAL_NFC_SPI_DWP_SYNC 21
+#define DWP_ACCESS_RETRY_CNT 5
+#define DWP_ACCESS_WAIT_TIME 2000 /* max. wait for a DWP release, in ms */
 
 extern int omapi_status;
 extern unsigned long gFelicaAppTimeout;
+extern uint32_t phPalEse_spi_getDwpReleaseSeq(void);
+extern bool phPalEse_spi_waitDwpRelease(uint32_t seq, unsigned long timeoutMs);
 bool state_machine_debug = true;
 
 map<eStates_t, StateBase *> StateBase::sListOfStates;
@@ -351,6 +355,7 @@ StateBase *StateBase::InitializeStates() {
 
 eStatus_t StateBase::SendOMAPICommand(uint8_t cmd[], uint8_t cmd_len) {
   int nfc_access_retryCnt = 0;
+  uint32_t dwpReleaseSeq = 0;
   int retval;
   ese_nxp_IoctlInOutData_t inpOutData;
   memset(&inpOutData, 0x00, sizeof(ese_nxp_IoctlInOutData_t));
@@ -358,14 +363,17 @@ eStatus_t StateBase::SendOMAPICommand(uint8_t cmd[], uint8_t cmd_len) {
   inpOutData.inp.data_source = 1;
   memcpy(inpOutData.inp.data.nxpCmd.p_cmd, cmd, cmd_len);
 retry_nfc_access:
+  dwpReleaseSeq = phPalEse_spi_getDwpReleaseSeq();
   retval =
       NfcAdaptation::GetInstance().HalIoctl(HAL_NFC_SPI_DWP_SYNC, &inpOutData);
   if (omapi_status != 0) {
     ALOGE_IF(state_machine_debug, "omapi_status return failed");
     nfc_access_retryCnt++;
-    usleep(2000000);
-    if (nfc_access_retryCnt < 5)
+    if (nfc_access_retryCnt < DWP_ACCESS_RETRY_CNT) {
+      /* Retry as soon as NFC HAL releases the DWP channel */
+      phPalEse_spi_waitDwpRelease(dwpReleaseSeq, DWP_ACCESS_WAIT_TIME);
       goto retry_nfc_access;
+    }
     return SM_STATUS_FAILED;
   }
 
@@ -20,6 +20,7 @@
 #define LSCLIENT_H_
 
 #include <android/hardware/secure_element/1.0/ISecureElementHalCallback.h>
+#include "hal_nxpese.h"
 
 typedef enum {
   LSCSTATUS_SUCCESS = (0x0000),
@@ -43,4 +44,15 @@ using ::android::hardware::secure_element::V1_0::ISecureElementHalCallback;
 LSCSTATUS LSC_doDownload(
     const android::sp<ISecureElementHalCallback>& clientCallback);
 
+/*******************************************************************************
+**
+** Function:        LSC_GetProgress
+**
+** Description:     Snapshot of the current/last LS script execution progress
+**
+** Returns:         SUCCESS if ok
+**
+*******************************************************************************/
+LSCSTATUS LSC_GetProgress(ese_nxp_LsProgress_t* pProgress);
+
 #endif /* LSCLIENT_H_ */
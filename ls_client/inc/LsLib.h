@@ -51,9 +51,24 @@ typedef struct Lsc_ImageInfo {
   uint8_t initChannelNum;
 } Lsc_ImageInfo_t;
 
+/* Response out file record formats */
+#define LS_RESP_FORMAT_HEX 0x00 /* One ASCII hex line per response */
+#define LS_RESP_FORMAT_BIN 0x01 /* Raw 61 TLV records back to back */
+#define LS_RESP_FORMAT_PROP "vendor.ese.ls_resp_format"
+#define LS_RESP_SINK_SIZE (8 * 1024)
+
+/* APDU latency histogram used for the LS progress p99 */
+#define LS_LATENCY_BUCKET_US 1000
+#define LS_LATENCY_BUCKETS 1024
+
+typedef struct Lsc_RespSink {
+  uint8_t buf[LS_RESP_SINK_SIZE];
+  uint32_t len;
+  uint8_t format;
+} Lsc_RespSink_t;
+
 typedef struct Lsc_HashInfo {
   uint16_t readHashLen;
-  uint8_t* lsRawScriptBuf = nullptr;
   uint8_t* lsScriptHash = nullptr;
   uint8_t* readBuffHash = nullptr;
 } Lsc_HashInfo_t;
@@ -98,6 +113,8 @@ static uint8_t SelectLscSlotHash[] = {0x00, 0xA4, 0x04, 0x00, 0x10, 0xA0, 0x00,
 #define LS_ABORT_SW1 0x69
 #define LS_ABORT_SW2 0x87
 #define LS_STATUS_PATH "/data/vendor/secure_element/LS_Status.txt"
+/*Script summaries kept for the LS status file of one session*/
+#define LS_MAX_SESSION_SUMMARIES 10
 #define LS_SRC_BACKUP "/data/vendor/secure_element/LS_Src_Backup.txt"
 #define LS_DST_BACKUP "/data/vendor/secure_element/LS_Dst_Backup.txt"
 #define MAX_CERT_LEN (255 + 137)
@@ -139,12 +156,14 @@ static uint8_t SelectLscSlotHash[] = {0x00, 0xA4, 0x04, 0x00, 0x10, 0xA0, 0x00,
 ** Function:        Perform_LSC
 **
 ** Description:     Performs the LSC download sequence
+**                  fScript, if not NULL, is the already opened script which
+**                  is used instead of reopening path and closed when done.
 **
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-LSCSTATUS Perform_LSC(const char* path, const char* dest, const uint8_t* pdata,
-                      uint16_t len, uint8_t* respSW);
+LSCSTATUS Perform_LSC(const char* path, const char* dest, FILE* fScript,
+                      const uint8_t* pdata, uint16_t len, uint8_t* respSW);
 
 /*******************************************************************************
 **
@@ -226,7 +245,7 @@ static LSCSTATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
 static LSCSTATUS LSC_update_seq_handler(
     LSCSTATUS (*seq_handler[])(Lsc_ImageInfo_t* pContext, LSCSTATUS status,
                                Lsc_TranscieveInfo_t* pInfo),
-    const char* name, const char* dest) __attribute__((unused));
+    const char* name, const char* dest, FILE* fScript) __attribute__((unused));
 
 /*******************************************************************************
 **
@@ -242,6 +261,78 @@ LSCSTATUS Write_Response_To_OutFile(Lsc_ImageInfo_t* image_info,
                                     uint8_t* RecvData, int32_t recvlen,
                                     Ls_TagType tType);
 
+/*******************************************************************************
+**
+** Function:        LSC_RespSinkOpen
+**
+** Description:     Opens the response out file and resets the response sink.
+**                  Record format is taken from LS_RESP_FORMAT_PROP.
+**
+** Returns:         Success if OK
+**
+*******************************************************************************/
+LSCSTATUS LSC_RespSinkOpen(Lsc_ImageInfo_t* image_info);
+
+/*******************************************************************************
+**
+** Function:        LSC_RespSinkFlush
+**
+** Description:     Writes the buffered response records to the out file.
+**                  On a checkpoint the file is also synced to storage.
+**
+** Returns:         Success if OK
+**
+*******************************************************************************/
+LSCSTATUS LSC_RespSinkFlush(Lsc_ImageInfo_t* image_info, bool checkpoint);
+
+/*******************************************************************************
+**
+** Function:        LSC_RespSinkClose
+**
+** Description:     Flushes pending records as a checkpoint and closes the
+**                  response out file.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LSC_RespSinkClose(Lsc_ImageInfo_t* image_info);
+
+/*******************************************************************************
+**
+** Function:        LSC_ProgressStart
+**
+** Description:     Resets the progress telemetry for the LS script about to
+**                  be executed from slot scriptIndex
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LSC_ProgressStart(uint8_t scriptIndex);
+
+/*******************************************************************************
+**
+** Function:        LSC_ProgressEnd
+**
+** Description:     Closes the progress telemetry of the current LS script and
+**                  keeps its summary for LSC_ProgressSessionEnd
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LSC_ProgressEnd(LSCSTATUS status);
+
+/*******************************************************************************
+**
+** Function:        LSC_ProgressSessionEnd
+**
+** Description:     Appends the summaries of the scripts run in this session
+**                  to the LS status file, once after the last script
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LSC_ProgressSessionEnd(void);
+
 /*******************************************************************************
 **
 ** Function:        Check_Certificate_Tag
@@ -25,9 +25,10 @@
 #include <stdlib.h>
 #include <string>
 #include "LsLib.h"
+#include "ese_boot_trace.h"
 
 uint8_t datahex(char c);
-unsigned char* getHASH(uint8_t* buffer, size_t buffSize);
+bool getHASH(FILE* fIn, uint8_t* outHash);
 extern bool ese_debug_enabled;
 
 #define ls_script_source_prefix "/vendor/etc/loaderservice_updater_"
@@ -40,10 +41,28 @@ const uint16_t HASH_STATUS_INDEX = 20;
 const uint8_t LS_MAX_COUNT = 10;
 const uint8_t LS_DOWNLOAD_SUCCESS = 0x00;
 const uint8_t LS_DOWNLOAD_FAILED = 0x01;
+const uint8_t LS_HASH_WORKER_COUNT = 2;
+const size_t LS_HASH_CHUNK_SIZE = 4096;
+
+/* Script discovery/hash result of one LS slot, filled by the hash workers */
+typedef struct Lsc_ScriptSlot {
+  std::string sourcePath;
+  FILE* fp; /* Hashed script rewound for the parser, NULL once handed over */
+  bool done;
+  bool present;
+  uint8_t hash[HASH_DATA_LENGTH];
+} Lsc_ScriptSlot_t;
 
 static android::sp<ISecureElementHalCallback> cCallback;
+static Lsc_ScriptSlot_t gsScriptSlots[LS_MAX_COUNT];
+static uint8_t gsNextSlot;
+static bool gsStopHashing;
+static pthread_mutex_t gsSlotLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gsSlotCond = PTHREAD_COND_INITIALIZER;
 void* performLSDownload_thread(void* data);
+void* lsHashWorker_thread(void* data);
 static void getLSScriptSourcePrefix(std::string& prefix);
+static FILE* getLSScriptHash(const char* path, uint8_t* outHash);
 
 void getLSScriptSourcePrefix(std::string& prefix) {
   char source_path[PROPERTY_VALUE_MAX] = {0};
@@ -70,19 +89,20 @@ void getLSScriptSourcePrefix(std::string& prefix) {
 ** Function:        LSC_Start
 **
 ** Description:     Starts the LSC update with encrypted data privided in the
-                    updater file
+                    updater file. Ownership of fScript passes to the parser.
 **
 ** Returns:         SUCCESS if ok.
 **
 *******************************************************************************/
-LSCSTATUS LSC_Start(const char* name, const char* dest, uint8_t* pdata,
-                    uint16_t len, uint8_t* respSW) {
+LSCSTATUS LSC_Start(const char* name, const char* dest, FILE* fScript,
+                    uint8_t* pdata, uint16_t len, uint8_t* respSW) {
   static const char fn[] = "LSC_Start";
   LSCSTATUS status = LSCSTATUS_FAILED;
   if (name != NULL) {
-    status = Perform_LSC(name, dest, pdata, len, respSW);
+    status = Perform_LSC(name, dest, fScript, pdata, len, respSW);
   } else {
     ALOGE("%s: LS script file is missing", fn);
+    if (fScript != NULL) fclose(fScript);
   }
   ALOGD_IF(ese_debug_enabled, "%s: Exit; status=0x0%X", fn, status);
   return status;
@@ -147,18 +167,51 @@ void* performLSDownload_thread(__attribute__((unused)) void* data) {
   Lsc_HashInfo_t lsHashInfo;
 
   getLSScriptSourcePrefix(sourcePrefix);
+
+  /*Discover, read and hash all the scripts in parallel to the eSE traffic*/
+  pthread_mutex_lock(&gsSlotLock);
+  for (uint8_t slot = 0; slot < LS_MAX_COUNT; slot++) {
+    gsScriptSlots[slot].sourcePath.assign(sourcePrefix);
+    gsScriptSlots[slot].sourcePath += ('0' + slot + 1);
+    gsScriptSlots[slot].sourcePath += ls_script_source_suffix;
+    gsScriptSlots[slot].fp = NULL;
+    gsScriptSlots[slot].done = false;
+    gsScriptSlots[slot].present = false;
+  }
+  gsNextSlot = 0;
+  gsStopHashing = false;
+  pthread_mutex_unlock(&gsSlotLock);
+
+  pthread_t workers[LS_HASH_WORKER_COUNT];
+  uint8_t workerCount = 0;
+  for (uint8_t i = 0; i < LS_HASH_WORKER_COUNT; i++) {
+    if (pthread_create(&workers[workerCount], NULL, &lsHashWorker_thread,
+                       NULL) != 0) {
+      ALOGE("%s: hash worker creation failed", __func__);
+      break;
+    }
+    workerCount++;
+  }
+  if (workerCount == 0) {
+    /*Fall back to hashing all the scripts from this thread*/
+    lsHashWorker_thread(NULL);
+  }
+
   do {
-    /*Open the script file from specified location and name*/
-    sourcePath.assign(sourcePrefix);
-    sourcePath += ('0' + index);
-    sourcePath += ls_script_source_suffix;
-    FILE* fIn = fopen(sourcePath.c_str(), "rb");
-    if (fIn == NULL) {
+    Lsc_ScriptSlot_t* pSlot = &gsScriptSlots[index - 1];
+    /*Wait for the script to be hashed by the workers*/
+    pthread_mutex_lock(&gsSlotLock);
+    while (!pSlot->done) {
+      pthread_cond_wait(&gsSlotCond, &gsSlotLock);
+    }
+    pthread_mutex_unlock(&gsSlotLock);
+
+    sourcePath.assign(pSlot->sourcePath);
+    if (!pSlot->present) {
       ALOGE("%s Cannot open LS script file %s\n", __func__, sourcePath.c_str());
-      ALOGE("%s Error : %s", __func__, strerror(errno));
       break;
     }
-    ALOGD_IF(ese_debug_enabled, "%s File opened %s\n", __func__,
+    ALOGD_IF(ese_debug_enabled, "%s File hashed %s\n", __func__,
              sourcePath.c_str());
 
     outPath.assign(ls_script_output_prefix);
@@ -170,24 +223,12 @@ void* performLSDownload_thread(__attribute__((unused)) void* data) {
       ALOGE("%s Failed to open file %s\n", __func__, outPath.c_str());
       break;
     }
-    /*Read the script content to a local buffer*/
-    fseek(fIn, 0, SEEK_END);
-    long lsBufSize = ftell(fIn);
-    rewind(fIn);
-    if (lsHashInfo.lsRawScriptBuf == nullptr) {
-      lsHashInfo.lsRawScriptBuf = (uint8_t*)phNxpEse_memalloc(lsBufSize + 1);
-    }
-    memset(lsHashInfo.lsRawScriptBuf, 0x00, (lsBufSize + 1));
-    fread(lsHashInfo.lsRawScriptBuf, lsBufSize, 1, fIn);
+    fclose(fOut);
 
     LSCSTATUS lsHashStatus = LSCSTATUS_FAILED;
 
-    /*Get 20bye SHA1 of the script*/
-    lsHashInfo.lsScriptHash =
-        getHASH(lsHashInfo.lsRawScriptBuf, (size_t)lsBufSize);
-    phNxpEse_free(lsHashInfo.lsRawScriptBuf);
-    lsHashInfo.lsRawScriptBuf = nullptr;
-    if (lsHashInfo.lsScriptHash == nullptr) break;
+    /*20byte SHA1 of the script computed by the hash workers*/
+    lsHashInfo.lsScriptHash = pSlot->hash;
 
     if (lsHashInfo.readBuffHash == nullptr) {
       lsHashInfo.readBuffHash = (uint8_t*)phNxpEse_memalloc(HASH_DATA_LENGTH);
@@ -207,12 +248,17 @@ void* performLSDownload_thread(__attribute__((unused)) void* data) {
         (lsHashInfo.readBuffHash[HASH_STATUS_INDEX] == LS_DOWNLOAD_SUCCESS)) {
       ALOGD_IF(ese_debug_enabled, "%s LS Loader sript is already installed \n",
                __func__);
+      fclose(pSlot->fp);
+      pSlot->fp = NULL;
       continue;
     }
 
     /*Uptdates current script*/
-    status = LSC_Start(sourcePath.c_str(), outPath.c_str(), (uint8_t*)hash,
-                       (uint16_t)sizeof(hash), resSW);
+    LSC_ProgressStart(index);
+    status = LSC_Start(sourcePath.c_str(), outPath.c_str(), pSlot->fp,
+                       (uint8_t*)hash, (uint16_t)sizeof(hash), resSW);
+    pSlot->fp = NULL;
+    LSC_ProgressEnd(status);
     ALOGD_IF(ese_debug_enabled, "%s script %s perform done, result = %d\n",
              __func__, sourcePath.c_str(), status);
     if (status != LSCSTATUS_SUCCESS) {
@@ -248,8 +294,50 @@ void* performLSDownload_thread(__attribute__((unused)) void* data) {
   } while (++index <= LS_MAX_COUNT);
 
   phNxpEse_free(lsHashInfo.readBuffHash);
+  LSC_ProgressSessionEnd();
 
+  /*Remaining scripts are not needed anymore*/
+  pthread_mutex_lock(&gsSlotLock);
+  gsStopHashing = true;
+  pthread_mutex_unlock(&gsSlotLock);
+  for (uint8_t i = 0; i < workerCount; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  for (uint8_t slot = 0; slot < LS_MAX_COUNT; slot++) {
+    if (gsScriptSlots[slot].fp != NULL) {
+      fclose(gsScriptSlots[slot].fp);
+      gsScriptSlots[slot].fp = NULL;
+    }
+  }
+
+  phNxpEse_ArbStats_t arbStats;
+  phNxpEse_GetArbStats(&arbStats);
+  ALOGD_IF(ese_debug_enabled,
+           "%s LS apdus=%u yields=%u yieldMs=%llu; OMAPI apdus=%u waits=%u "
+           "waitMs=%llu waitMaxMs=%u",
+           __func__, arbStats.bgApduCount, arbStats.bgYieldCount,
+           (unsigned long long)arbStats.bgYieldTimeMs, arbStats.fgApduCount,
+           arbStats.fgWaitCount, (unsigned long long)arbStats.fgWaitTimeMs,
+           arbStats.fgWaitMaxMs);
+  /*Buckets of 0 ms, 1 ms, 2-3 ms, 4-7 ms, ... up to ESE_ARB_WAIT_BUCKETS*/
+  std::string fgWaitHist;
+  std::string bgYieldHist;
+  for (uint8_t i = 0; i < ESE_ARB_WAIT_BUCKETS; i++) {
+    if (i != 0) {
+      fgWaitHist += '/';
+      bgYieldHist += '/';
+    }
+    fgWaitHist += std::to_string(arbStats.fgWaitHist[i]);
+    bgYieldHist += std::to_string(arbStats.bgYieldHist[i]);
+  }
+  ALOGD_IF(ese_debug_enabled, "%s OMAPI wait hist %s; LS yield hist %s",
+           __func__, fgWaitHist.c_str(), bgYieldHist.c_str());
+  /*Scripts may have installed or removed applets*/
+  phNxpEse_InvalidateContent();
+
+  eseBootTrace_end("ls_download");
   if (status == LSCSTATUS_SUCCESS) {
+    eseBootTrace_publish();
     cCallback->onStateChange(true);
   }
   pthread_exit(NULL);
@@ -257,28 +345,97 @@ void* performLSDownload_thread(__attribute__((unused)) void* data) {
   return NULL;
 }
 
+/*******************************************************************************
+**
+** Function:        lsHashWorker_thread
+**
+** Description:     Picks the next unprocessed LS slot, reads and hashes its
+**                  script and publishes the result until all slots are done
+**
+** Returns:         None
+**
+*******************************************************************************/
+void* lsHashWorker_thread(__attribute__((unused)) void* data) {
+  while (true) {
+    pthread_mutex_lock(&gsSlotLock);
+    if (gsStopHashing || (gsNextSlot >= LS_MAX_COUNT)) {
+      pthread_mutex_unlock(&gsSlotLock);
+      break;
+    }
+    Lsc_ScriptSlot_t* pSlot = &gsScriptSlots[gsNextSlot++];
+    pthread_mutex_unlock(&gsSlotLock);
+
+    memset(pSlot->hash, 0x00, HASH_DATA_LENGTH);
+    FILE* fp = getLSScriptHash(pSlot->sourcePath.c_str(), pSlot->hash);
+
+    pthread_mutex_lock(&gsSlotLock);
+    pSlot->fp = fp;
+    pSlot->present = (fp != NULL);
+    pSlot->done = true;
+    pthread_cond_broadcast(&gsSlotCond);
+    pthread_mutex_unlock(&gsSlotLock);
+  }
+  return NULL;
+}
+
+/*******************************************************************************
+**
+** Function:        getLSScriptHash
+**
+** Description:     Opens the LS script at path and generates its SHA1. The
+**                  script is left open and rewound so that the parser reads
+**                  it without reopening.
+**
+** Returns:         Opened script if present and hashed, NULL otherwise
+**
+*******************************************************************************/
+static FILE* getLSScriptHash(const char* path, uint8_t* outHash) {
+  FILE* fIn = fopen(path, "rb");
+  if (fIn == NULL) {
+    ALOGD_IF(ese_debug_enabled, "%s Cannot open %s: %s", __func__, path,
+             strerror(errno));
+    return NULL;
+  }
+  if (!getHASH(fIn, outHash)) {
+    fclose(fIn);
+    return NULL;
+  }
+  rewind(fIn);
+  return fIn;
+}
+
 /*******************************************************************************
 **
 ** Function:        getHASH
 **
-** Description:     generates SHA1 of given buffer
+** Description:     generates SHA1 of the given file into outHash, reading it
+**                  in LS_HASH_CHUNK_SIZE chunks from the current position
 **
-** Returns:         20 bytes of SHA1
+** Returns:         true if 20 bytes of SHA1 are generated
 **
 *******************************************************************************/
-unsigned char* getHASH(uint8_t* buffer, size_t buffSize) {
-  static uint8_t outHash[HASH_DATA_LENGTH] = {0};
+bool getHASH(FILE* fIn, uint8_t* outHash) {
+  uint8_t chunk[LS_HASH_CHUNK_SIZE];
   unsigned int md_len = -1;
+  bool status = false;
   const EVP_MD* md = EVP_get_digestbyname("SHA1");
   if (NULL != md) {
     EVP_MD_CTX mdctx;
     EVP_MD_CTX_init(&mdctx);
     EVP_DigestInit_ex(&mdctx, md, NULL);
-    EVP_DigestUpdate(&mdctx, buffer, buffSize);
-    EVP_DigestFinal_ex(&mdctx, outHash, &md_len);
+    size_t readLen = 0;
+    while ((readLen = fread(chunk, 1, sizeof(chunk), fIn)) > 0) {
+      EVP_DigestUpdate(&mdctx, chunk, readLen);
+    }
+    if (ferror(fIn) == 0) {
+      EVP_DigestFinal_ex(&mdctx, outHash, &md_len);
+      status = true;
+    } else {
+      ALOGE("%s Error reading LS script", __func__);
+    }
     EVP_MD_CTX_cleanup(&mdctx);
   }
-  return outHash;
+  return status;
 }
 
 /*******************************************************************************
@@ -18,10 +18,14 @@
 #define LOG_TAG "LSClient"
 #include <LsClient.h>
 #include <LsLib.h>
+#include <cutils/properties.h>
 #include <errno.h>
 #include <log/log.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 extern bool ese_debug_enabled;
 
@@ -36,6 +40,24 @@ static uint8_t gsTag42Arr[17];
 static uint8_t gsTag45Arr[9];
 static uint8_t gsLsExecuteResp[4];
 static int32_t gsResp_len = 0;
+static Lsc_RespSink_t gsRespSink;
+
+/* LS execution progress, also read by LSC_GetProgress from binder threads */
+static ese_nxp_LsProgress_t gsProgress;
+static uint32_t gsLatencyHist[LS_LATENCY_BUCKETS + 1];
+static uint32_t gsLatencyMaxUs;
+static uint64_t gsLatencyTotalUs;
+static uint64_t gsScriptStartUs;
+static uint32_t gsWtxStartCount;
+static int32_t gsScriptSize;
+static int32_t gsScriptBytesRead;
+static pthread_mutex_t gsProgressLock = PTHREAD_MUTEX_INITIALIZER;
+/* Summaries of the scripts run in this session, written at its end */
+static ese_nxp_LsProgress_t gsSessionSummary[LS_MAX_SESSION_SUMMARIES];
+static uint8_t gsSessionSummaryCount;
+
+static ESESTATUS LSC_Transceive(phNxpEse_data* pCmd, phNxpEse_data* pRsp);
+static void LSC_ProgressRecord(Lsc_ImageInfo_t* Os_info);
 
 LSCSTATUS(*Applet_load_seqhandler[])
 (Lsc_ImageInfo_t* pContext, LSCSTATUS status, Lsc_TranscieveInfo_t* pInfo) = {
@@ -47,22 +69,26 @@ LSCSTATUS(*Applet_load_seqhandler[])
 ** Function:        Perform_LSC
 **
 ** Description:     Performs the LSC download sequence
+**                  fScript, if not NULL, is the already opened script which
+**                  is used instead of reopening path and closed when done.
 **
 ** Returns:         Success if ok.
 **
 *******************************************************************************/
-LSCSTATUS Perform_LSC(const char* name, const char* dest, const uint8_t* pdata,
-                      uint16_t len, uint8_t* respSW) {
+LSCSTATUS Perform_LSC(const char* name, const char* dest, FILE* fScript,
+                      const uint8_t* pdata, uint16_t len, uint8_t* respSW) {
   static const char fn[] = "Perform_LSC";
   ALOGD_IF(ese_debug_enabled, "%s: enter; sha-len=%d", fn, len);
   if ((pdata == NULL) || (len == 0x00)) {
     ALOGE("%s: Invalid SHA-data", fn);
+    if (fScript != NULL) fclose(fScript);
     return LSCSTATUS_FAILED;
   }
   gsStoreData[0] = STORE_DATA_TAG;
   gsStoreData[1] = len;
   memcpy(&gsStoreData[2], pdata, len);
-  LSCSTATUS status = LSC_update_seq_handler(Applet_load_seqhandler, name, dest);
+  LSCSTATUS status =
+      LSC_update_seq_handler(Applet_load_seqhandler, name, dest, fScript);
   if ((status != LSCSTATUS_SUCCESS) && (gsLsExecuteResp[2] == 0x90) &&
       (gsLsExecuteResp[3] == 0x00)) {
     gsLsExecuteResp[2] = LS_ABORT_SW1;
@@ -88,12 +114,14 @@ LSCSTATUS Perform_LSC(const char* name, const char* dest, const uint8_t* pdata,
 LSCSTATUS LSC_update_seq_handler(
     LSCSTATUS (*seq_handler[])(Lsc_ImageInfo_t* pContext, LSCSTATUS status,
                                Lsc_TranscieveInfo_t* pInfo),
-    const char* name, const char* dest) {
+    const char* name, const char* dest, FILE* fScript) {
   static const char fn[] = "LSC_update_seq_handler";
   Lsc_ImageInfo_t update_info;
 
   ALOGD_IF(ese_debug_enabled, "%s: enter", fn);
   memset(&update_info, 0, sizeof(Lsc_ImageInfo_t));
+  /*Script already opened (and hashed) by the caller is reused by the parser*/
+  update_info.fp = fScript;
   if (dest != NULL) {
     strcat(update_info.fls_RespPath, dest);
     ALOGD_IF(ese_debug_enabled,
@@ -103,6 +131,7 @@ LSCSTATUS LSC_update_seq_handler(
     update_info.bytes_wrote = 0x55;
   }
   if ((LSC_UpdateExeStatus(LS_DEFAULT_STATUS)) != true) {
+    if (update_info.fp != NULL) fclose(update_info.fp);
     return LSCSTATUS_FAILED;
   }
   // memcpy(update_info.fls_path, (char*)Lsc_path, sizeof(Lsc_path));
@@ -129,6 +158,11 @@ LSCSTATUS LSC_update_seq_handler(
     seq_counter++;
   }
 
+  /*Sequence aborted before the script was consumed*/
+  if (update_info.fp != NULL) {
+    fclose(update_info.fp);
+    update_info.fp = NULL;
+  }
   LSC_CloseChannel(&update_info, LSCSTATUS_FAILED, &trans_info);
   ALOGD_IF(ese_debug_enabled, "%s: exit; status=0x%x", fn, status);
   return status;
@@ -161,7 +195,7 @@ LSCSTATUS LSC_OpenChannel(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
   memcpy(cmdApdu.p_data, OpenChannel, cmdApdu.len);
 
   ALOGD_IF(ese_debug_enabled, "%s: Calling Secure Element Transceive", fn);
-  ESESTATUS eseStat = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+  ESESTATUS eseStat = LSC_Transceive(&cmdApdu, &rspApdu);
 
   if (eseStat != ESESTATUS_SUCCESS && (rspApdu.len < 0x03)) {
     if (rspApdu.len == 0x02)
@@ -217,7 +251,7 @@ LSCSTATUS LSC_ResetChannel(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
 
   do {
     ALOGD_IF(ese_debug_enabled, "%s: Calling Secure Element Transceive", fn);
-    eseStat = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+    eseStat = LSC_Transceive(&cmdApdu, &rspApdu);
     if (eseStat != ESESTATUS_SUCCESS && (rspApdu.len < 0x03)) {
       status = LSCSTATUS_FAILED;
       ALOGE("%s: SE transceive failed status = 0x%X", fn, status);
@@ -287,7 +321,7 @@ LSCSTATUS LSC_SelectLsc(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
   ALOGD_IF(ese_debug_enabled,
            "%s: Calling Secure Element Transceive with Loader service AID", fn);
 
-  ESESTATUS eseStat = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+  ESESTATUS eseStat = LSC_Transceive(&cmdApdu, &rspApdu);
 
   if (eseStat != ESESTATUS_SUCCESS && (rspApdu.len == 0x00)) {
     status = LSCSTATUS_FAILED;
@@ -349,7 +383,7 @@ LSCSTATUS LSC_StoreData(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
   memcpy(&(cmdApdu.p_data[xx]), gsStoreData, len);
 
   ALOGD_IF(ese_debug_enabled, "%s: Calling Secure Element Transceive", fn);
-  ESESTATUS eseStat = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+  ESESTATUS eseStat = LSC_Transceive(&cmdApdu, &rspApdu);
 
   if ((eseStat != ESESTATUS_SUCCESS) && (rspApdu.len == 0x00)) {
     status = LSCSTATUS_FAILED;
@@ -389,10 +423,7 @@ LSCSTATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
     return LSCSTATUS_FAILED;
   }
   if (Os_info->bytes_wrote == 0xAA) {
-    Os_info->fResp = fopen(Os_info->fls_RespPath, "a+");
-    if (Os_info->fResp == NULL) {
-      ALOGE("%s: Error opening response recording file <%s> for reading: %s",
-            fn, Os_info->fls_path, strerror(errno));
+    if (LSC_RespSinkOpen(Os_info) != LSCSTATUS_SUCCESS) {
       return LSCSTATUS_FAILED;
     }
     ALOGD_IF(ese_debug_enabled,
@@ -402,7 +433,9 @@ LSCSTATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
              "%s: Response Out file is optional as per input", fn);
   }
 
-  Os_info->fp = fopen(Os_info->fls_path, "r");
+  if (Os_info->fp == NULL) {
+    Os_info->fp = fopen(Os_info->fls_path, "r");
+  }
   if (Os_info->fp == NULL) {
     ALOGE("%s: Error opening OS image file <%s> for reading: %s", fn,
           Os_info->fls_path, strerror(errno));
@@ -446,6 +479,7 @@ LSCSTATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
     if (status != LSCSTATUS_SUCCESS) {
       goto exit;
     }
+    LSC_ProgressRecord(Os_info);
     /*Reset the flag in case further commands exists*/
     reachEOFCheck = false;
 
@@ -487,6 +521,10 @@ LSCSTATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
       if (tag40_found == LSCSTATUS_SUCCESS) {
         ALOGD_IF(ese_debug_enabled,
                  "%s: 2nd Script processing starts with reselect", fn);
+        /*Previous script responses are complete, checkpoint them*/
+        if (Os_info->bytes_wrote == 0xAA) {
+          LSC_RespSinkFlush(Os_info, true);
+        }
         status = LSCSTATUS_FAILED;
         status = LSC_SelectLsc(Os_info, status, pTranscv_Info);
         if (status == LSCSTATUS_SUCCESS) {
@@ -537,16 +575,18 @@ LSCSTATUS LSC_loadapplet(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
     }
   }
   if (Os_info->bytes_wrote == 0xAA) {
-    fclose(Os_info->fResp);
+    LSC_RespSinkClose(Os_info);
   }
   LSC_UpdateExeStatus(LS_SUCCESS_STATUS);
   wResult = fclose(Os_info->fp);
+  Os_info->fp = NULL;
   ALOGD_IF(ese_debug_enabled, "%s: exit, status=0x%x", fn, status);
   return status;
 exit:
   wResult = fclose(Os_info->fp);
+  Os_info->fp = NULL;
   if (Os_info->bytes_wrote == 0xAA) {
-    fclose(Os_info->fResp);
+    LSC_RespSinkClose(Os_info);
   }
   /*Script ends with SW 6320 and reached END OF FILE*/
   if (reachEOFCheck == true) {
@@ -813,7 +853,7 @@ LSCSTATUS LSC_SendtoEse(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
     cmdApdu.p_data = (uint8_t*)phNxpEse_memalloc(cmdApdu.len * sizeof(uint8_t));
     memcpy(cmdApdu.p_data, pTranscv_Info->sSendData, cmdApdu.len);
 
-    ESESTATUS eseStat = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+    ESESTATUS eseStat = LSC_Transceive(&cmdApdu, &rspApdu);
 
     if (eseStat != ESESTATUS_SUCCESS) {
       ALOGE("%s: Transceive failed; status=0x%X", fn, eseStat);
@@ -881,7 +921,7 @@ LSCSTATUS LSC_SendtoLsc(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
   cmdApdu.p_data = (uint8_t*)phNxpEse_memalloc(cmdApdu.len * sizeof(uint8_t));
   memcpy(cmdApdu.p_data, pTranscv_Info->sSendData, cmdApdu.len);
 
-  ESESTATUS eseStat = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+  ESESTATUS eseStat = LSC_Transceive(&cmdApdu, &rspApdu);
 
   if (eseStat != ESESTATUS_SUCCESS) {
     ALOGE("%s: Transceive failed; status=0x%X", fn, eseStat);
@@ -933,7 +973,7 @@ LSCSTATUS LSC_CloseChannel(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
     cmdApdu.p_data[xx++] = Os_info->Channel_Info[cnt].channel_id;
     cmdApdu.p_data[xx++] = 0x00;
 
-    ESESTATUS eseStat = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+    ESESTATUS eseStat = LSC_Transceive(&cmdApdu, &rspApdu);
 
     if (eseStat != ESESTATUS_SUCCESS || rspApdu.len < 2) {
       ALOGD_IF(ese_debug_enabled, "%s: Transceive failed; status=0x%X", fn,
@@ -1239,7 +1279,7 @@ LSCSTATUS Send_Backall_Loadcmds(Lsc_ImageInfo_t* Os_info, LSCSTATUS status,
 
       memcpy(cmdApdu.p_data, &gspBuffer[1], cmdApdu.len);
 
-      ESESTATUS eseStat = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+      ESESTATUS eseStat = LSC_Transceive(&cmdApdu, &rspApdu);
       memcpy(pTranscv_Info->sRecvData, rspApdu.p_data, rspApdu.len);
       int32_t recvBufferActualSize = rspApdu.len;
       phNxpEse_free(cmdApdu.p_data);
@@ -1354,6 +1394,39 @@ uint8_t Numof_lengthbytes(uint8_t* read_buf, int32_t* pLen) {
   return len_byte;
 }
 
+/*******************************************************************************
+**
+** Function:        LSC_RespSinkPut
+**
+** Description:     Appends len bytes of data to the response sink in the
+**                  configured record format, flushing whenever it fills up.
+**
+** Returns:         Success if OK
+**
+*******************************************************************************/
+static LSCSTATUS LSC_RespSinkPut(Lsc_ImageInfo_t* image_info,
+                                 const uint8_t* data, int32_t len) {
+  static const char hexDigits[] = "0123456789ABCDEF";
+  const uint32_t width = (gsRespSink.format == LS_RESP_FORMAT_HEX) ? 2 : 1;
+  int32_t index = 0;
+
+  while (index < len) {
+    if ((gsRespSink.len + width) > sizeof(gsRespSink.buf)) {
+      if (LSC_RespSinkFlush(image_info, false) != LSCSTATUS_SUCCESS) {
+        return LSCSTATUS_FAILED;
+      }
+    }
+    if (width == 2) {
+      gsRespSink.buf[gsRespSink.len++] = hexDigits[data[index] >> 4];
+      gsRespSink.buf[gsRespSink.len++] = hexDigits[data[index] & 0x0F];
+    } else {
+      gsRespSink.buf[gsRespSink.len++] = data[index];
+    }
+    index++;
+  }
+  return LSCSTATUS_SUCCESS;
+}
+
 /*******************************************************************************
 **
 ** Function:        Write_Response_To_OutFile
@@ -1462,37 +1535,112 @@ LSCSTATUS Write_Response_To_OutFile(Lsc_ImageInfo_t* image_info,
     /*Do nothing*/
   }
 
-  uint8_t tempLen = 0;
-  LSCSTATUS wStatus = LSCSTATUS_FAILED;
-  int32_t status = 0;
-  while (tempLen < tagLen) {
-    status = fprintf(image_info->fResp, "%02X", tagBuffer[tempLen++]);
-    if (status != 2) {
-      ALOGE("%s: Invalid Response during fprintf; status=0x%x", fn, (status));
-      wStatus = LSCSTATUS_FAILED;
-      break;
-    }
-  }
+  LSCSTATUS wStatus = LSC_RespSinkPut(image_info, tagBuffer, tagLen);
   /*Updating the response data into out script*/
-  int32_t respLen = 0;
-  while (respLen < recvlen) {
-    status = fprintf(image_info->fResp, "%02X", RecvData[respLen++]);
-    if (status != 2) {
-      ALOGE("%s: Invalid Response during fprintf; status=0x%x", fn, (status));
-      wStatus = LSCSTATUS_FAILED;
-      break;
+  if (wStatus == LSCSTATUS_SUCCESS) {
+    wStatus = LSC_RespSinkPut(image_info, RecvData, recvlen);
+  }
+  if ((wStatus == LSCSTATUS_SUCCESS) &&
+      (gsRespSink.format == LS_RESP_FORMAT_HEX)) {
+    static const uint8_t newLine = '\n';
+    if (gsRespSink.len == sizeof(gsRespSink.buf)) {
+      wStatus = LSC_RespSinkFlush(image_info, false);
     }
+    gsRespSink.buf[gsRespSink.len++] = newLine;
   }
-  if (status == 2) {
-    fprintf(image_info->fResp, "%s\n", "");
+  if (wStatus == LSCSTATUS_SUCCESS) {
     ALOGD_IF(ese_debug_enabled,
              "%s: SUCCESS Response written to script out file", fn);
-    wStatus = LSCSTATUS_SUCCESS;
+  } else {
+    ALOGE("%s: Invalid Response during write", fn);
+  }
+  return wStatus;
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_RespSinkOpen
+**
+** Description:     Opens the response out file and resets the response sink.
+**                  Record format is taken from LS_RESP_FORMAT_PROP.
+**
+** Returns:         Success if OK
+**
+*******************************************************************************/
+LSCSTATUS LSC_RespSinkOpen(Lsc_ImageInfo_t* image_info) {
+  static const char fn[] = "LSC_RespSinkOpen";
+  char format[PROPERTY_VALUE_MAX] = {0};
+
+  image_info->fResp = fopen(image_info->fls_RespPath, "a+");
+  if (image_info->fResp == NULL) {
+    ALOGE("%s: Error opening response recording file <%s> for writing: %s",
+          fn, image_info->fls_RespPath, strerror(errno));
+    return LSCSTATUS_FAILED;
+  }
+  /*Records are batched in gsRespSink, stdio buffering is not needed*/
+  setvbuf(image_info->fResp, NULL, _IONBF, 0);
+  gsRespSink.len = 0;
+  gsRespSink.format = LS_RESP_FORMAT_HEX;
+  if ((property_get(LS_RESP_FORMAT_PROP, format, "") > 0) &&
+      (strcmp(format, "bin") == 0)) {
+    gsRespSink.format = LS_RESP_FORMAT_BIN;
+  }
+  ALOGD_IF(ese_debug_enabled, "%s: response format=%d", fn,
+           gsRespSink.format);
+  return LSCSTATUS_SUCCESS;
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_RespSinkFlush
+**
+** Description:     Writes the buffered response records to the out file.
+**                  On a checkpoint the file is also synced to storage.
+**
+** Returns:         Success if OK
+**
+*******************************************************************************/
+LSCSTATUS LSC_RespSinkFlush(Lsc_ImageInfo_t* image_info, bool checkpoint) {
+  static const char fn[] = "LSC_RespSinkFlush";
+  LSCSTATUS wStatus = LSCSTATUS_SUCCESS;
+
+  if (image_info->fResp == NULL) {
+    return LSCSTATUS_FAILED;
+  }
+  if (gsRespSink.len > 0) {
+    if (fwrite(gsRespSink.buf, 1, gsRespSink.len, image_info->fResp) !=
+        gsRespSink.len) {
+      ALOGE("%s: Error writing response out file: %s", fn, strerror(errno));
+      wStatus = LSCSTATUS_FAILED;
+    }
+    gsRespSink.len = 0;
+  }
+  if (checkpoint && (fsync(fileno(image_info->fResp)) != 0)) {
+    ALOGE("%s: Error syncing response out file: %s", fn, strerror(errno));
+    wStatus = LSCSTATUS_FAILED;
   }
-  fflush(image_info->fResp);
   return wStatus;
 }
 
+/*******************************************************************************
+**
+** Function:        LSC_RespSinkClose
+**
+** Description:     Flushes pending records as a checkpoint and closes the
+**                  response out file.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LSC_RespSinkClose(Lsc_ImageInfo_t* image_info) {
+  if (image_info->fResp == NULL) {
+    return;
+  }
+  LSC_RespSinkFlush(image_info, true);
+  fclose(image_info->fResp);
+  image_info->fResp = NULL;
+}
+
 /*******************************************************************************
 **
 ** Function:        Check_Certificate_Tag
@@ -1958,7 +2106,7 @@ LSCSTATUS LSC_CloseAllLogicalChannels(Lsc_ImageInfo_t* Os_info) {
       cmdApdu.p_data[xx++] = 0x00;           // Lc
       cmdApdu.len = xx;
 
-      status = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+      status = LSC_Transceive(&cmdApdu, &rspApdu);
     }
     if (status != ESESTATUS_SUCCESS) {
       lsStatus = LSCSTATUS_FAILED;
@@ -1996,7 +2144,7 @@ LSCSTATUS LSC_SelectLsHash() {
   cmdApdu.p_data = (uint8_t*)phNxpEse_memalloc(cmdApdu.len * sizeof(uint8_t));
   memcpy(cmdApdu.p_data, SelectLscSlotHash, sizeof(SelectLscSlotHash));
 
-  ESESTATUS eseStat = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+  ESESTATUS eseStat = LSC_Transceive(&cmdApdu, &rspApdu);
 
   if ((eseStat != ESESTATUS_SUCCESS) ||
       ((rspApdu.p_data[rspApdu.len - 2] != 0x90) &&
@@ -2041,7 +2189,7 @@ LSCSTATUS LSC_ReadLsHash(uint8_t* hash, uint16_t* readHashLen, uint8_t slotId) {
     cmdApdu.p_data[xx++] = 0x00;    // P2
     cmdApdu.len = xx;
 
-    ESESTATUS eseStat = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+    ESESTATUS eseStat = LSC_Transceive(&cmdApdu, &rspApdu);
 
     if ((eseStat == ESESTATUS_SUCCESS) &&
         ((rspApdu.p_data[rspApdu.len - 2] == 0x90) &&
@@ -2106,7 +2254,7 @@ LSCSTATUS LSC_UpdateLsHash(uint8_t* hash, long hashLen, uint8_t slotId) {
     cmdApdu.p_data[xx++] = hashLen;  // Lc
     memcpy(&cmdApdu.p_data[xx], hash, hashLen);
 
-    ESESTATUS eseStat = phNxpEse_Transceive(&cmdApdu, &rspApdu);
+    ESESTATUS eseStat = LSC_Transceive(&cmdApdu, &rspApdu);
 
     if ((eseStat == ESESTATUS_SUCCESS) &&
         ((rspApdu.p_data[rspApdu.len - 2] == 0x90) &&
@@ -2126,3 +2274,217 @@ LSCSTATUS LSC_UpdateLsHash(uint8_t* hash, long hashLen, uint8_t slotId) {
   phNxpEse_free(rspApdu.p_data);
   return lsStatus;
 }
+
+/*******************************************************************************
+**
+** Function:        LSC_GetTimeUs
+**
+** Description:     Monotonic clock in micro seconds
+**
+** Returns:         Current time
+**
+*******************************************************************************/
+static uint64_t LSC_GetTimeUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_Transceive
+**
+** Description:     Exchanges an LS APDU with the eSE and accounts it in the
+**                  progress telemetry
+**
+** Returns:         ESESTATUS of the exchange
+**
+*******************************************************************************/
+static ESESTATUS LSC_Transceive(phNxpEse_data* pCmd, phNxpEse_data* pRsp) {
+  uint64_t startUs = LSC_GetTimeUs();
+  ESESTATUS eseStat = phNxpEse_BgTransceive(pCmd, pRsp);
+  uint32_t latencyUs = (uint32_t)(LSC_GetTimeUs() - startUs);
+
+  pthread_mutex_lock(&gsProgressLock);
+  gsProgress.apduCount++;
+  gsProgress.bytesSent += pCmd->len;
+  gsLatencyTotalUs += latencyUs;
+  if (latencyUs > gsLatencyMaxUs) gsLatencyMaxUs = latencyUs;
+  uint32_t bucket = latencyUs / LS_LATENCY_BUCKET_US;
+  gsLatencyHist[(bucket < LS_LATENCY_BUCKETS) ? bucket : LS_LATENCY_BUCKETS]++;
+  pthread_mutex_unlock(&gsProgressLock);
+  return eseStat;
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_ProgressRecord
+**
+** Description:     Accounts a script record read by the parser
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void LSC_ProgressRecord(Lsc_ImageInfo_t* Os_info) {
+  pthread_mutex_lock(&gsProgressLock);
+  gsProgress.recordsDone++;
+  gsScriptSize = Os_info->fls_size;
+  gsScriptBytesRead = Os_info->bytes_read;
+  pthread_mutex_unlock(&gsProgressLock);
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_ProgressStart
+**
+** Description:     Resets the progress telemetry for the LS script about to
+**                  be executed from slot scriptIndex
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LSC_ProgressStart(uint8_t scriptIndex) {
+  pthread_mutex_lock(&gsProgressLock);
+  memset(&gsProgress, 0, sizeof(gsProgress));
+  memset(gsLatencyHist, 0, sizeof(gsLatencyHist));
+  gsLatencyMaxUs = 0;
+  gsLatencyTotalUs = 0;
+  gsScriptSize = 0;
+  gsScriptBytesRead = 0;
+  gsProgress.scriptIndex = scriptIndex;
+  gsProgress.state = LS_PROGRESS_STATE_RUNNING;
+  gsScriptStartUs = LSC_GetTimeUs();
+  gsWtxStartCount = phNxpEse_GetWtxCount();
+  pthread_mutex_unlock(&gsProgressLock);
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_GetProgress
+**
+** Description:     Snapshot of the current/last LS script execution progress
+**
+** Returns:         SUCCESS if ok
+**
+*******************************************************************************/
+LSCSTATUS LSC_GetProgress(ese_nxp_LsProgress_t* pProgress) {
+  if (pProgress == NULL) return LSCSTATUS_FAILED;
+
+  pthread_mutex_lock(&gsProgressLock);
+  memcpy(pProgress, &gsProgress, sizeof(ese_nxp_LsProgress_t));
+  if (gsProgress.state == LS_PROGRESS_STATE_RUNNING) {
+    pProgress->elapsedMs =
+        (uint32_t)((LSC_GetTimeUs() - gsScriptStartUs) / 1000);
+    pProgress->wtxCount = phNxpEse_GetWtxCount() - gsWtxStartCount;
+  }
+  if (gsProgress.apduCount > 0) {
+    pProgress->avgLatencyUs =
+        (uint32_t)(gsLatencyTotalUs / gsProgress.apduCount);
+    /*Upper edge of the bucket holding the 99th percentile*/
+    uint32_t rank = gsProgress.apduCount - (gsProgress.apduCount / 100);
+    uint32_t count = 0;
+    pProgress->p99LatencyUs = gsLatencyMaxUs;
+    for (uint32_t bucket = 0; bucket < LS_LATENCY_BUCKETS; bucket++) {
+      count += gsLatencyHist[bucket];
+      if (count >= rank) {
+        pProgress->p99LatencyUs = (bucket + 1) * LS_LATENCY_BUCKET_US;
+        break;
+      }
+    }
+  }
+  if (gsScriptBytesRead > 0) {
+    /*Extrapolate from the portion of the script parsed so far*/
+    pProgress->recordsTotal = (uint32_t)(((uint64_t)gsProgress.recordsDone *
+                                          gsScriptSize) /
+                                         gsScriptBytesRead);
+    if (pProgress->state == LS_PROGRESS_STATE_RUNNING) {
+      pProgress->etaMs =
+          (uint32_t)(((uint64_t)pProgress->elapsedMs *
+                      (gsScriptSize - gsScriptBytesRead)) /
+                     gsScriptBytesRead);
+    }
+  }
+  pthread_mutex_unlock(&gsProgressLock);
+  return LSCSTATUS_SUCCESS;
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_ProgressEnd
+**
+** Description:     Closes the progress telemetry of the current LS script and
+**                  keeps its summary for LSC_ProgressSessionEnd
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LSC_ProgressEnd(LSCSTATUS status) {
+  static const char fn[] = "LSC_ProgressEnd";
+  ese_nxp_LsProgress_t summary;
+
+  pthread_mutex_lock(&gsProgressLock);
+  gsProgress.elapsedMs = (uint32_t)((LSC_GetTimeUs() - gsScriptStartUs) / 1000);
+  gsProgress.wtxCount = phNxpEse_GetWtxCount() - gsWtxStartCount;
+  gsProgress.state = (status == LSCSTATUS_SUCCESS) ? LS_PROGRESS_STATE_DONE
+                                                   : LS_PROGRESS_STATE_FAILED;
+  pthread_mutex_unlock(&gsProgressLock);
+  LSC_GetProgress(&summary);
+
+  ALOGD_IF(ese_debug_enabled,
+           "%s: script=%d state=%d records=%u apdus=%u bytes=%u avgUs=%u "
+           "p99Us=%u wtx=%u elapsedMs=%u",
+           fn, summary.scriptIndex, summary.state, summary.recordsDone,
+           summary.apduCount, summary.bytesSent, summary.avgLatencyUs,
+           summary.p99LatencyUs, summary.wtxCount, summary.elapsedMs);
+
+  /*Each script rewrites the status word, summaries are written at the end*/
+  pthread_mutex_lock(&gsProgressLock);
+  if (gsSessionSummaryCount < LS_MAX_SESSION_SUMMARIES) {
+    gsSessionSummary[gsSessionSummaryCount++] = summary;
+  } else {
+    ALOGE("%s: no room for the summary of script %d", fn,
+          summary.scriptIndex);
+  }
+  pthread_mutex_unlock(&gsProgressLock);
+}
+
+/*******************************************************************************
+**
+** Function:        LSC_ProgressSessionEnd
+**
+** Description:     Appends the summaries of the scripts run in this session
+**                  to the LS status file, once after the last script
+**
+** Returns:         None
+**
+*******************************************************************************/
+void LSC_ProgressSessionEnd(void) {
+  static const char fn[] = "LSC_ProgressSessionEnd";
+  ese_nxp_LsProgress_t summaries[LS_MAX_SESSION_SUMMARIES];
+  uint8_t count = 0;
+
+  pthread_mutex_lock(&gsProgressLock);
+  count = gsSessionSummaryCount;
+  memcpy(summaries, gsSessionSummary, count * sizeof(ese_nxp_LsProgress_t));
+  gsSessionSummaryCount = 0;
+  pthread_mutex_unlock(&gsProgressLock);
+  if (count == 0) return;
+
+  /*Summaries go after the status word so that Get_LsStatus is unaffected*/
+  FILE* fLsStatus = fopen(LS_STATUS_PATH, "a");
+  if (fLsStatus == NULL) {
+    ALOGE("%s: Error opening LS Status file: %s", fn, strerror(errno));
+    return;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    fprintf(fLsStatus,
+            "\nscript=%d state=%d records=%u apdus=%u bytes=%u avgUs=%u "
+            "p99Us=%u wtx=%u elapsedMs=%u",
+            summaries[i].scriptIndex, summaries[i].state,
+            summaries[i].recordsDone, summaries[i].apduCount,
+            summaries[i].bytesSent, summaries[i].avgLatencyUs,
+            summaries[i].p99LatencyUs, summaries[i].wtxCount,
+            summaries[i].elapsedMs);
+  }
+  fclose(fLsStatus);
+}